@@ -0,0 +1,462 @@
+#pragma once
+
+#include <libpq-fe.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "logger.h"
+
+// Result of one statement run by AsyncDBExecutor. Values are raw libpq
+// strings: text output, or the type's binary send format with ResultFormat::Binary.
+struct AsyncResult {
+    bool ok = false;
+    std::string error;
+    std::vector<std::vector<std::optional<std::string>>> rows; // NULL -> std::nullopt
+    size_t affected_rows = 0;
+};
+
+// Runs prepared statements on a few non-blocking libpq connections driven by
+// a single epoll loop, so no thread ever blocks on a Postgres round trip.
+//
+// Callers submit a statement name plus text parameters and get the result
+// through a callback (run on the loop thread, so it must be quick) or a
+// future. Each connection runs one statement at a time; further submissions
+// queue until a connection is idle, and fail if none frees up within
+// queue_timeout. A statement (or a connection attempt, including preparing
+// the statements) that takes longer than query_timeout fails, and its
+// connection is closed and reopened, so a stalled server or network never
+// leaves a caller waiting forever. Connections are opened with
+// PQconnectStart/PQconnectPoll, prepare the given statement set once, and
+// reconnect after reconnect_delay when they break.
+class AsyncDBExecutor {
+public:
+    using Callback = std::function<void(AsyncResult)>;
+
+    // libpq result format: binary skips the server's output conversion (for
+    // bytea, hex encoding) and the client's decoding
+    enum class ResultFormat { Text = 0, Binary = 1 };
+
+    AsyncDBExecutor(const std::string& conninfo, size_t connections,
+                    std::vector<std::pair<std::string, std::string>> statements,
+                    std::chrono::milliseconds queue_timeout,
+                    std::chrono::milliseconds query_timeout = std::chrono::milliseconds(5000),
+                    std::chrono::milliseconds reconnect_delay = std::chrono::milliseconds(1000))
+        : _conninfo(conninfo), _statements(std::move(statements)), _queue_timeout(queue_timeout),
+          _query_timeout(query_timeout), _reconnect_delay(reconnect_delay), _conns(connections) {
+        _epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        _wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.ptr = nullptr; // nullptr marks the wakeup eventfd
+        if (_epoll_fd < 0 || _wake_fd < 0 || epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, _wake_fd, &ev) != 0) {
+            std::string error = std::strerror(errno);
+            if (_wake_fd >= 0) close(_wake_fd);
+            if (_epoll_fd >= 0) close(_epoll_fd);
+            throw std::runtime_error("Async DB executor setup failed: " + error);
+        }
+        _loop = std::thread([this] { run(); });
+    }
+
+    ~AsyncDBExecutor() {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stopping = true;
+        }
+        wake();
+        _loop.join();
+        close(_wake_fd);
+        close(_epoll_fd);
+    }
+
+    AsyncDBExecutor(const AsyncDBExecutor&) = delete;
+    AsyncDBExecutor& operator=(const AsyncDBExecutor&) = delete;
+
+    // Queue a prepared statement; done runs on the event loop thread
+    void execute(const std::string& statement, std::vector<std::string> params, Callback done,
+                 ResultFormat format = ResultFormat::Text) {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (!_stopping) {
+                _submitted.push_back(Job{statement, std::move(params), std::move(done),
+                                         std::chrono::steady_clock::now() + _queue_timeout, format});
+                done = nullptr;
+            }
+        }
+        if (done) {
+            done(failure("Executor is shutting down"));
+            return;
+        }
+        wake();
+    }
+
+    std::future<AsyncResult> execute(const std::string& statement, std::vector<std::string> params,
+                                     ResultFormat format = ResultFormat::Text) {
+        auto promise = std::make_shared<std::promise<AsyncResult>>();
+        std::future<AsyncResult> future = promise->get_future();
+        execute(statement, std::move(params), [promise](AsyncResult result) { promise->set_value(std::move(result)); },
+                format);
+        return future;
+    }
+
+    // Encodes values as a Postgres text-format array literal, e.g. {"a","b\"c"}
+    static std::string to_array_literal(const std::vector<std::string>& values) {
+        std::string out = "{";
+        for (size_t i = 0; i < values.size(); ++i) {
+            if (i > 0) out += ',';
+            out += '"';
+            for (char c : values[i]) {
+                if (c == '"' || c == '\\') out += '\\';
+                out += c;
+            }
+            out += '"';
+        }
+        out += '}';
+        return out;
+    }
+
+private:
+    struct Job {
+        std::string statement;
+        std::vector<std::string> params;
+        Callback done;
+        std::chrono::steady_clock::time_point deadline; // Fail if still queued by then
+        ResultFormat format;
+    };
+
+    enum class State { Disconnected, Connecting, Preparing, Idle, Busy };
+
+    struct Conn {
+        PGconn* pg = nullptr;
+        State state = State::Disconnected;
+        int fd = -1;                // Socket currently registered with epoll
+        size_t next_prepare = 0;    // Index into _statements while Preparing
+        std::optional<Job> job;     // Statement in flight while Busy
+        AsyncResult result;         // Accumulated result of the current command
+        std::chrono::steady_clock::time_point retry_at;
+        std::chrono::steady_clock::time_point deadline; // Connecting, Preparing or Busy: give up by then
+    };
+
+    std::string _conninfo;
+    std::vector<std::pair<std::string, std::string>> _statements;
+    std::chrono::milliseconds _queue_timeout;
+    std::chrono::milliseconds _query_timeout;
+    std::chrono::milliseconds _reconnect_delay;
+    std::vector<Conn> _conns;
+    int _epoll_fd = -1;
+    int _wake_fd = -1;
+    std::thread _loop;
+
+    std::mutex _mutex; // Guards _submitted and _stopping
+    std::deque<Job> _submitted;
+    bool _stopping = false;
+
+    std::deque<Job> _queue; // Loop thread only: jobs waiting for an idle connection
+
+    static AsyncResult failure(const std::string& error) {
+        AsyncResult result;
+        result.error = error;
+        return result;
+    }
+
+    static void complete(Callback& done, AsyncResult result) {
+        try {
+            done(std::move(result));
+        } catch (const std::exception& e) {
+            log_event(std::string("ASYNC DB: Completion callback threw: ") + e.what());
+        }
+    }
+
+    void wake() {
+        uint64_t one = 1;
+        ssize_t ignored = write(_wake_fd, &one, sizeof(one));
+        (void)ignored;
+    }
+
+    void run() {
+        for (auto& c : _conns) start_connect(c);
+
+        std::vector<epoll_event> events(_conns.size() + 1);
+        while (true) {
+            int n = epoll_wait(_epoll_fd, events.data(), static_cast<int>(events.size()), next_timeout_ms());
+            for (int i = 0; i < n; ++i) {
+                if (events[i].data.ptr == nullptr) {
+                    uint64_t count;
+                    ssize_t ignored = read(_wake_fd, &count, sizeof(count));
+                    (void)ignored;
+                    continue;
+                }
+                handle_io(*static_cast<Conn*>(events[i].data.ptr), events[i].events);
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                if (_stopping) break;
+                while (!_submitted.empty()) {
+                    _queue.push_back(std::move(_submitted.front()));
+                    _submitted.pop_front();
+                }
+            }
+
+            auto now = std::chrono::steady_clock::now();
+            for (auto& c : _conns) {
+                if (in_progress(c) && now >= c.deadline) {
+                    drop(c, c.state == State::Busy ? "Query timed out" : "Connecting timed out");
+                }
+                if (c.state == State::Disconnected && now >= c.retry_at) start_connect(c);
+            }
+            dispatch();
+
+            // Jobs are queued in deadline order; expire those no connection picked up
+            while (!_queue.empty() && _queue.front().deadline <= now) {
+                complete(_queue.front().done, failure("Timed out waiting for a database connection"));
+                _queue.pop_front();
+            }
+        }
+        shutdown();
+    }
+
+    static bool in_progress(const Conn& c) {
+        return c.state == State::Connecting || c.state == State::Preparing || c.state == State::Busy;
+    }
+
+    // Sleep until the next reconnect attempt, connection or queued-job
+    // deadline, or indefinitely
+    int next_timeout_ms() const {
+        int timeout = -1;
+        auto now = std::chrono::steady_clock::now();
+        auto consider = [&](std::chrono::steady_clock::time_point at) {
+            auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(at - now).count();
+            int ms = wait < 0 ? 0 : static_cast<int>(wait) + 1;
+            if (timeout < 0 || ms < timeout) timeout = ms;
+        };
+        for (const auto& c : _conns) {
+            if (c.state == State::Disconnected) consider(c.retry_at);
+            if (in_progress(c)) consider(c.deadline);
+        }
+        if (!_queue.empty()) consider(_queue.front().deadline);
+        return timeout;
+    }
+
+    void dispatch() {
+        for (auto& c : _conns) {
+            if (_queue.empty()) return;
+            if (c.state != State::Idle) continue;
+            c.job = std::move(_queue.front());
+            _queue.pop_front();
+            send_job(c);
+        }
+    }
+
+    void watch(Conn& c, uint32_t events) {
+        int fd = PQsocket(c.pg);
+        epoll_event ev{};
+        ev.events = events;
+        ev.data.ptr = &c;
+        if (fd != c.fd) {
+            // libpq may switch sockets while connecting (e.g. multiple hosts)
+            if (c.fd >= 0) epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, c.fd, nullptr);
+            c.fd = fd;
+            if (fd >= 0) epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+        } else if (fd >= 0) {
+            epoll_ctl(_epoll_fd, EPOLL_CTL_MOD, fd, &ev);
+        }
+    }
+
+    void start_connect(Conn& c) {
+        c.pg = PQconnectStart(_conninfo.c_str());
+        if (!c.pg || PQstatus(c.pg) == CONNECTION_BAD || PQsocket(c.pg) < 0) {
+            drop(c, c.pg ? PQerrorMessage(c.pg) : "Out of memory");
+            return;
+        }
+        c.state = State::Connecting;
+        c.deadline = std::chrono::steady_clock::now() + _query_timeout;
+        watch(c, EPOLLOUT); // PQconnectStart behaves as if PQconnectPoll returned WRITING
+    }
+
+    void continue_connect(Conn& c) {
+        switch (PQconnectPoll(c.pg)) {
+        case PGRES_POLLING_READING:
+            watch(c, EPOLLIN);
+            break;
+        case PGRES_POLLING_WRITING:
+            watch(c, EPOLLOUT);
+            break;
+        case PGRES_POLLING_OK:
+            PQsetnonblocking(c.pg, 1);
+            log_event("ASYNC DB: Connection established");
+            c.state = State::Preparing;
+            c.next_prepare = 0;
+            send_next_prepare(c);
+            break;
+        default:
+            drop(c, PQerrorMessage(c.pg));
+            break;
+        }
+    }
+
+    void send_next_prepare(Conn& c) {
+        if (c.next_prepare == _statements.size()) {
+            c.state = State::Idle;
+            watch(c, EPOLLIN); // Still notice server-side disconnects while idle
+            return;
+        }
+        const auto& statement = _statements[c.next_prepare++];
+        c.result = AsyncResult{};
+        if (!PQsendPrepare(c.pg, statement.first.c_str(), statement.second.c_str(), 0, nullptr)) {
+            drop(c, PQerrorMessage(c.pg));
+            return;
+        }
+        flush(c);
+    }
+
+    void send_job(Conn& c) {
+        std::vector<const char*> values;
+        values.reserve(c.job->params.size());
+        for (const auto& param : c.job->params) values.push_back(param.c_str());
+
+        c.state = State::Busy;
+        c.deadline = std::chrono::steady_clock::now() + _query_timeout;
+        c.result = AsyncResult{};
+        // libpq copies the parameters into its output buffer before returning
+        if (!PQsendQueryPrepared(c.pg, c.job->statement.c_str(), static_cast<int>(values.size()),
+                                 values.data(), nullptr, nullptr, static_cast<int>(c.job->format))) {
+            drop(c, PQerrorMessage(c.pg));
+            return;
+        }
+        flush(c);
+    }
+
+    void flush(Conn& c) {
+        int pending = PQflush(c.pg);
+        if (pending < 0) {
+            drop(c, PQerrorMessage(c.pg));
+        } else {
+            watch(c, pending == 1 ? (EPOLLIN | EPOLLOUT) : EPOLLIN);
+        }
+    }
+
+    void handle_io(Conn& c, uint32_t events) {
+        if (c.state == State::Connecting) {
+            continue_connect(c);
+            return;
+        }
+        if (c.state == State::Disconnected) return;
+
+        if (events & EPOLLOUT) {
+            flush(c);
+            if (c.state == State::Disconnected) return;
+        }
+        if (!(events & (EPOLLIN | EPOLLERR | EPOLLHUP))) return;
+
+        if (!PQconsumeInput(c.pg)) {
+            drop(c, PQerrorMessage(c.pg));
+            return;
+        }
+        while (!PQisBusy(c.pg)) {
+            PGresult* res = PQgetResult(c.pg);
+            if (!res) {
+                command_done(c);
+                return;
+            }
+            collect(c, res);
+            PQclear(res);
+        }
+    }
+
+    void collect(Conn& c, PGresult* res) {
+        switch (PQresultStatus(res)) {
+        case PGRES_TUPLES_OK: {
+            int rows = PQntuples(res), cols = PQnfields(res);
+            for (int r = 0; r < rows; ++r) {
+                std::vector<std::optional<std::string>> row;
+                row.reserve(cols);
+                for (int f = 0; f < cols; ++f) {
+                    if (PQgetisnull(res, r, f)) {
+                        row.emplace_back(std::nullopt);
+                    } else {
+                        row.emplace_back(std::string(PQgetvalue(res, r, f), PQgetlength(res, r, f)));
+                    }
+                }
+                c.result.rows.push_back(std::move(row));
+            }
+            break;
+        }
+        case PGRES_COMMAND_OK:
+            c.result.affected_rows = std::strtoull(PQcmdTuples(res), nullptr, 10);
+            break;
+        default:
+            c.result.error = PQresultErrorMessage(res);
+            break;
+        }
+    }
+
+    void command_done(Conn& c) {
+        bool ok = c.result.error.empty();
+        if (c.state == State::Preparing) {
+            if (!ok) {
+                drop(c, "Preparing statements failed: " + c.result.error);
+                return;
+            }
+            send_next_prepare(c);
+            return;
+        }
+        if (c.state != State::Busy) return; // e.g. stray input while idle
+
+        c.result.ok = ok;
+        Job job = std::move(*c.job);
+        c.job.reset();
+        c.state = State::Idle;
+        complete(job.done, std::move(c.result));
+        dispatch();
+    }
+
+    // Close a broken connection, fail its in-flight job and schedule a reconnect
+    void drop(Conn& c, const std::string& error) {
+        log_event("ASYNC DB: Connection lost: " + error);
+        if (c.fd >= 0) epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, c.fd, nullptr);
+        c.fd = -1;
+        if (c.pg) PQfinish(c.pg);
+        c.pg = nullptr;
+        c.state = State::Disconnected;
+        c.retry_at = std::chrono::steady_clock::now() + _reconnect_delay;
+        if (c.job) {
+            Job job = std::move(*c.job);
+            c.job.reset();
+            complete(job.done, failure(error));
+        }
+    }
+
+    void shutdown() {
+        for (auto& c : _conns) {
+            if (c.job) {
+                complete(c.job->done, failure("Executor is shutting down"));
+                c.job.reset();
+            }
+            if (c.pg) PQfinish(c.pg);
+            c.pg = nullptr;
+        }
+        std::deque<Job> leftover;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            leftover.swap(_submitted);
+        }
+        for (auto& job : _queue) complete(job.done, failure("Executor is shutting down"));
+        for (auto& job : leftover) complete(job.done, failure("Executor is shutting down"));
+        _queue.clear();
+    }
+};
@@ -0,0 +1,154 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "logger.h"
+
+// Collects items submitted concurrently by request handlers and hands them to
+// a flush function in batches. A batch is flushed once max_items are queued
+// or `window` has passed since its first item arrived. Several flusher
+// threads let the next batch fill while the previous one is in flight.
+//
+// The flush function must return one result per item, in order. If it throws,
+// every item in the batch completes with a default-constructed Result, so
+// Result{} should mean failure (false, std::nullopt, ...). An asynchronous
+// flush function instead hands its results to a completion callback later
+// (e.g. from an I/O thread), which frees the flusher for the next batch
+// immediately.
+template <typename Item, typename Result>
+class Batcher {
+public:
+    using Callback = std::function<void(Result)>;
+    using FlushFn = std::function<std::vector<Result>(const std::vector<Item>&)>;
+    using Completion = std::function<void(std::vector<Result>)>;
+    using AsyncFlushFn = std::function<void(const std::vector<Item>&, Completion)>;
+
+    Batcher(const std::string& name, FlushFn flush, std::chrono::microseconds window,
+            size_t max_items, size_t flusher_count = 1)
+        : Batcher(name,
+                  AsyncFlushFn([flush](const std::vector<Item>& items, Completion done) { done(flush(items)); }),
+                  window, max_items, flusher_count) {}
+
+    Batcher(const std::string& name, AsyncFlushFn flush, std::chrono::microseconds window,
+            size_t max_items, size_t flusher_count = 1)
+        : _name(name), _flush(std::move(flush)), _window(window), _max_items(max_items) {
+        for (size_t i = 0; i < flusher_count; ++i) {
+            _flushers.emplace_back([this] { flush_loop(); });
+        }
+    }
+
+    ~Batcher() {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stopping = true;
+        }
+        _cv.notify_all();
+        for (auto& t : _flushers) t.join();
+    }
+
+    Batcher(const Batcher&) = delete;
+    Batcher& operator=(const Batcher&) = delete;
+
+    // Queue an item; done runs on a flusher thread once its batch completes
+    void submit(Item item, Callback done) {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (_pending.empty()) _batch_started = std::chrono::steady_clock::now();
+            _pending.push_back(Pending{std::move(item), std::move(done)});
+        }
+        _cv.notify_one();
+    }
+
+    // Queue an item and get a future for its result
+    std::future<Result> submit(Item item) {
+        auto promise = std::make_shared<std::promise<Result>>();
+        std::future<Result> future = promise->get_future();
+        submit(std::move(item), [promise](Result result) { promise->set_value(std::move(result)); });
+        return future;
+    }
+
+private:
+    struct Pending {
+        Item item;
+        Callback done;
+    };
+
+    std::string _name;
+    AsyncFlushFn _flush;
+    std::chrono::microseconds _window;
+    size_t _max_items;
+    std::deque<Pending> _pending;
+    std::chrono::steady_clock::time_point _batch_started;
+    bool _stopping = false;
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    std::vector<std::thread> _flushers;
+
+    void flush_loop() {
+        while (true) {
+            std::vector<Pending> batch;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _cv.wait(lock, [this] { return _stopping || !_pending.empty(); });
+                if (_pending.empty()) return; // Stopping with nothing left to flush
+
+                // Give concurrent requests until the window closes to join the batch
+                while (!_stopping && _pending.size() < _max_items) {
+                    auto deadline = _batch_started + _window;
+                    if (_cv.wait_until(lock, deadline) == std::cv_status::timeout) break;
+                    if (_pending.empty()) break; // Another flusher took the batch
+                }
+                if (_pending.empty()) continue;
+
+                size_t count = std::min(_pending.size(), _max_items);
+                batch.reserve(count);
+                for (size_t i = 0; i < count; ++i) {
+                    batch.push_back(std::move(_pending.front()));
+                    _pending.pop_front();
+                }
+                if (!_pending.empty()) {
+                    _batch_started = std::chrono::steady_clock::now();
+                    _cv.notify_one();
+                }
+            }
+            run_batch(batch);
+        }
+    }
+
+    void run_batch(std::vector<Pending>& batch) {
+        std::vector<Item> items;
+        items.reserve(batch.size());
+        for (auto& pending : batch) items.push_back(std::move(pending.item));
+
+        // Completes every waiter exactly once, even if the flush both calls
+        // the completion and then throws
+        auto waiting = std::make_shared<std::vector<Pending>>(std::move(batch));
+        auto completed = std::make_shared<std::atomic<bool>>(false);
+        Completion finish = [waiting, completed](std::vector<Result> results) {
+            if (completed->exchange(true)) return;
+            if (results.size() != waiting->size()) results.assign(waiting->size(), Result{});
+            for (size_t i = 0; i < waiting->size(); ++i) {
+                (*waiting)[i].done(std::move(results[i]));
+            }
+        };
+
+        try {
+            _flush(items, finish);
+        } catch (const std::exception& e) {
+            log_event("BATCH " + _name + ": Flush of " + std::to_string(items.size()) + " item(s) failed: " + e.what());
+            finish({});
+        }
+    }
+};
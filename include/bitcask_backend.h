@@ -0,0 +1,579 @@
+#pragma once
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "crc32.h"
+#include "logger.h"
+#include "storage_backend.h"
+
+// Embedded, log-structured hash store (Bitcask-style) for running without a
+// database server.
+//
+// Every write is appended to the active data file as
+// [u32 CRC32][u64 seq][u8 flags][u32 key length][u32 value length][key][value],
+// the CRC covering everything after itself. An in-memory keydir maps each
+// live key to the location of its latest record, so a read is one map lookup
+// and one pread. Data files rotate at max_file_bytes and are never modified
+// again. A background thread compacts them once more than compaction_ratio of
+// the stored bytes are overwritten or deleted records: live records are
+// copied into fresh files and the old ones are deleted.
+//
+// The last record of each batch carries a batch-end flag. On open, every data
+// file is replayed (the highest seq of a key wins, so replay order does not
+// matter) and records after the last complete batch are cut off, which makes
+// batch() atomic across crashes.
+class BitcaskBackend : public StorageBackend {
+public:
+    BitcaskBackend(const std::string& dir, size_t max_file_bytes, double compaction_ratio,
+                   std::chrono::milliseconds compaction_interval)
+        : _dir(dir), _max_file_bytes(max_file_bytes), _compaction_ratio(compaction_ratio),
+          _compaction_interval(compaction_interval) {}
+
+    ~BitcaskBackend() override {
+        {
+            std::lock_guard<std::mutex> lock(_compactor_mutex);
+            _stopping = true;
+        }
+        _compactor_cv.notify_all();
+        if (_compactor.joinable()) _compactor.join();
+        if (_active_fd >= 0) fdatasync(_active_fd);
+        for (auto& file : _files) close(file.second.fd);
+    }
+
+    BitcaskBackend(const BitcaskBackend&) = delete;
+    BitcaskBackend& operator=(const BitcaskBackend&) = delete;
+
+    std::string name() const override { return "bitcask"; }
+
+    void open() override {
+        std::lock_guard<std::mutex> write_lock(_write_mutex);
+        {
+            std::unique_lock<std::shared_mutex> lock(_mutex);
+            mkdir(_dir.c_str(), 0755);
+
+            std::unordered_map<std::string, uint64_t> deleted; // Tombstone seq per key
+            for (uint64_t id : list_files()) {
+                std::string path = file_path(id);
+                int fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+                if (fd < 0) throw std::runtime_error("Cannot open " + path + ": " + std::strerror(errno));
+                _files[id] = DataFile{fd, 0, 0};
+                load_file(id, deleted);
+                _next_file_id = id + 1;
+            }
+            for (const auto& entry : _keydir) _live_bytes += entry.second.size;
+            log_event("BITCASK: Loaded " + std::to_string(_keydir.size()) + " key(s) from " + std::to_string(_files.size()) + " data file(s) in " + _dir);
+        }
+        open_active_file();
+
+        _compactor = std::thread([this] { compaction_loop(); });
+    }
+
+    std::optional<std::string> get(const std::string& key) override {
+        std::shared_lock<std::shared_mutex> lock(_mutex);
+        return read_locked(key);
+    }
+
+    std::vector<std::optional<std::string>> multi_get(const std::vector<std::string>& keys) override {
+        std::shared_lock<std::shared_mutex> lock(_mutex);
+        std::vector<std::optional<std::string>> values;
+        values.reserve(keys.size());
+        for (const auto& key : keys) values.push_back(read_locked(key));
+        return values;
+    }
+
+    // Keys are compared bytewise
+    std::vector<std::pair<std::string, std::string>> scan(const std::string& prefix,
+                                                          const std::optional<std::string>& start_after,
+                                                          size_t limit) override {
+        std::shared_lock<std::shared_mutex> lock(_mutex);
+        std::vector<std::pair<std::string, std::string>> entries;
+        auto it = start_after && *start_after >= prefix ? _keydir.upper_bound(*start_after)
+                                                        : _keydir.lower_bound(prefix);
+        for (; it != _keydir.end() && entries.size() < limit; ++it) {
+            if (it->first.compare(0, prefix.size(), prefix) != 0) break;
+            entries.emplace_back(it->first, read_value(it->second));
+        }
+        return entries;
+    }
+
+    // The whole batch goes out in one write(); a durable batch is then
+    // fdatasync'd before any of it becomes visible to readers.
+    std::vector<bool> batch(const std::vector<WriteOp>& ops, bool durable) override {
+        std::lock_guard<std::mutex> write_lock(_write_mutex);
+        if (_active_fd < 0) throw std::runtime_error("Bitcask store is not open");
+
+        // Deletes report whether the key existed, counting earlier ops of this batch
+        std::vector<bool> results(ops.size(), true);
+        std::vector<size_t> logged;
+        std::unordered_map<std::string, bool> exists;
+        {
+            std::shared_lock<std::shared_mutex> lock(_mutex);
+            for (size_t i = 0; i < ops.size(); ++i) {
+                bool is_put = ops[i].kind == WriteOp::Kind::Put;
+                if (!is_put) {
+                    auto it = exists.find(ops[i].key);
+                    results[i] = it != exists.end() ? it->second : _keydir.count(ops[i].key) > 0;
+                    if (!results[i]) continue; // Nothing to delete, nothing to log
+                }
+                exists[ops[i].key] = is_put;
+                logged.push_back(i);
+            }
+        }
+        if (logged.empty()) return results;
+
+        std::string buffer;
+        std::vector<Location> locations;
+        locations.reserve(logged.size());
+        for (size_t n = 0; n < logged.size(); ++n) {
+            const WriteOp& op = ops[logged[n]];
+            uint8_t flags = op.kind == WriteOp::Kind::Delete ? FLAG_TOMBSTONE : 0;
+            if (n + 1 == logged.size()) flags |= FLAG_BATCH_END;
+            std::string record = encode(_next_seq, flags, op.key, op.value);
+            locations.push_back(Location{_active_id, _active_size + buffer.size(),
+                                         static_cast<uint32_t>(record.size()), _next_seq});
+            ++_next_seq;
+            buffer += record;
+        }
+
+        if (!write_all(_active_fd, buffer.data(), buffer.size())) {
+            int err = errno;
+            if (ftruncate(_active_fd, static_cast<off_t>(_active_size)) != 0) {
+                log_event("BITCASK: Could not roll back a partial write to " + file_path(_active_id));
+            }
+            throw std::runtime_error("Bitcask write failed: " + std::string(std::strerror(err)));
+        }
+        _active_size += buffer.size();
+        if (durable && fdatasync(_active_fd) != 0) {
+            throw std::runtime_error("Bitcask fsync failed: " + std::string(std::strerror(errno)));
+        }
+
+        bool full;
+        {
+            std::unique_lock<std::shared_mutex> lock(_mutex);
+            _files[_active_id].size = _active_size;
+            _total_bytes += buffer.size();
+            for (size_t n = 0; n < logged.size(); ++n) {
+                const WriteOp& op = ops[logged[n]];
+                auto it = _keydir.find(op.key);
+                if (it != _keydir.end()) {
+                    _live_bytes -= it->second.size;
+                    if (op.kind == WriteOp::Kind::Delete) _keydir.erase(it);
+                }
+                if (op.kind == WriteOp::Kind::Put) {
+                    _keydir[op.key] = locations[n];
+                    _live_bytes += locations[n].size;
+                }
+            }
+            full = _active_size >= _max_file_bytes;
+        }
+        if (full) rotate();
+        return results;
+    }
+
+private:
+    static constexpr uint8_t FLAG_TOMBSTONE = 1;
+    static constexpr uint8_t FLAG_BATCH_END = 2;
+    static constexpr size_t HEADER_SIZE = 21; // crc, seq, flags, key length, value length
+
+    struct Location {
+        uint64_t file_id;
+        uint64_t offset; // Start of the record
+        uint32_t size; // Whole record, header included
+        uint64_t seq;
+
+        bool operator==(const Location& other) const {
+            return file_id == other.file_id && offset == other.offset;
+        }
+    };
+
+    struct DataFile {
+        int fd;
+        uint64_t size;
+        uint64_t min_seq; // Lowest seq written to the file (0 if empty)
+    };
+
+    struct Record {
+        uint64_t seq;
+        uint8_t flags;
+        std::string key;
+        std::string value;
+        uint64_t offset;
+        uint32_t size;
+    };
+
+    std::string _dir;
+    size_t _max_file_bytes;
+    double _compaction_ratio;
+    std::chrono::milliseconds _compaction_interval;
+
+    // Serializes writers and rotation; owns the active file
+    std::mutex _write_mutex;
+    int _active_fd = -1;
+    uint64_t _active_id = 0;
+    uint64_t _active_size = 0;
+    uint64_t _next_seq = 1;
+
+    // Guards the keydir, the open files and the byte counters
+    std::shared_mutex _mutex;
+    std::map<std::string, Location> _keydir;
+    std::map<uint64_t, DataFile> _files;
+    uint64_t _next_file_id = 1;
+    uint64_t _live_bytes = 0;
+    uint64_t _total_bytes = 0;
+
+    std::thread _compactor;
+    std::mutex _compactor_mutex;
+    std::condition_variable _compactor_cv;
+    bool _stopping = false;
+
+    template <typename T>
+    static void put_int(std::string& out, T value) {
+        out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    template <typename T>
+    static T get_int(const char* data) {
+        T value;
+        std::memcpy(&value, data, sizeof(value));
+        return value;
+    }
+
+    static std::string encode(uint64_t seq, uint8_t flags, const std::string& key, const std::string& value) {
+        std::string record;
+        record.reserve(HEADER_SIZE + key.size() + value.size());
+        put_int<uint32_t>(record, 0); // CRC, filled in below
+        put_int<uint64_t>(record, seq);
+        put_int<uint8_t>(record, flags);
+        put_int<uint32_t>(record, static_cast<uint32_t>(key.size()));
+        put_int<uint32_t>(record, static_cast<uint32_t>(value.size()));
+        record += key;
+        record += value;
+        uint32_t crc = crc32(record.data() + 4, record.size() - 4);
+        std::memcpy(&record[0], &crc, sizeof(crc));
+        return record;
+    }
+
+    // Parses the record at pos; std::nullopt if it is torn or corrupt
+    static std::optional<Record> decode(const std::string& data, size_t pos) {
+        if (pos + HEADER_SIZE > data.size()) return std::nullopt;
+        const char* p = data.data() + pos;
+        uint32_t key_len = get_int<uint32_t>(p + 13);
+        uint32_t value_len = get_int<uint32_t>(p + 17);
+        uint64_t size = HEADER_SIZE + static_cast<uint64_t>(key_len) + value_len;
+        if (pos + size > data.size()) return std::nullopt;
+        if (crc32(p + 4, size - 4) != get_int<uint32_t>(p)) return std::nullopt;
+        return Record{get_int<uint64_t>(p + 4), get_int<uint8_t>(p + 12),
+                      std::string(p + HEADER_SIZE, key_len), std::string(p + HEADER_SIZE + key_len, value_len),
+                      pos, static_cast<uint32_t>(size)};
+    }
+
+    static bool write_all(int fd, const char* data, size_t len) {
+        while (len > 0) {
+            ssize_t n = write(fd, data, len);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            data += n;
+            len -= static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    static bool read_all(int fd, std::string& out) {
+        out.clear();
+        char buf[65536];
+        off_t offset = 0;
+        while (true) {
+            ssize_t n = pread(fd, buf, sizeof(buf), offset);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            if (n == 0) return true;
+            out.append(buf, static_cast<size_t>(n));
+            offset += n;
+        }
+    }
+
+    std::string file_path(uint64_t id) const {
+        char name[32];
+        std::snprintf(name, sizeof(name), "data-%010llu.log", static_cast<unsigned long long>(id));
+        return _dir + "/" + name;
+    }
+
+    std::vector<uint64_t> list_files() const {
+        std::vector<uint64_t> ids;
+        DIR* dir = opendir(_dir.c_str());
+        if (!dir) return ids;
+        while (dirent* entry = readdir(dir)) {
+            unsigned long long id;
+            if (std::sscanf(entry->d_name, "data-%10llu.log", &id) == 1) ids.push_back(id);
+        }
+        closedir(dir);
+        std::sort(ids.begin(), ids.end());
+        return ids;
+    }
+
+    void sync_dir() const {
+        int dir_fd = ::open(_dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dir_fd >= 0) {
+            fsync(dir_fd);
+            close(dir_fd);
+        }
+    }
+
+    // Replays one data file into the keydir (called from open() with both
+    // locks held), cutting off a torn tail or an incomplete last batch
+    void load_file(uint64_t id, std::unordered_map<std::string, uint64_t>& deleted) {
+        DataFile& file = _files[id];
+        std::string data;
+        if (!read_all(file.fd, data)) {
+            throw std::runtime_error("Cannot read " + file_path(id) + ": " + std::strerror(errno));
+        }
+
+        std::vector<Record> batch;
+        size_t committed = 0;
+        size_t pos = 0;
+        while (auto record = decode(data, pos)) {
+            pos += record->size;
+            bool batch_end = record->flags & FLAG_BATCH_END;
+            batch.push_back(std::move(*record));
+            if (!batch_end) continue;
+
+            for (auto& r : batch) {
+                if (file.min_seq == 0 || r.seq < file.min_seq) file.min_seq = r.seq;
+                _next_seq = std::max(_next_seq, r.seq + 1);
+                auto it = _keydir.find(r.key);
+                if (it != _keydir.end() && it->second.seq > r.seq) continue;
+                if (r.flags & FLAG_TOMBSTONE) {
+                    if (it != _keydir.end()) _keydir.erase(it);
+                    uint64_t& tombstone = deleted[r.key];
+                    tombstone = std::max(tombstone, r.seq);
+                    continue;
+                }
+                auto tombstone = deleted.find(r.key);
+                if (tombstone != deleted.end() && tombstone->second > r.seq) continue;
+                _keydir[r.key] = Location{id, r.offset, r.size, r.seq};
+            }
+            batch.clear();
+            committed = pos;
+        }
+
+        if (committed < data.size()) {
+            log_event("BITCASK: Truncating incomplete tail of " + file_path(id) + " at offset " + std::to_string(committed));
+            if (ftruncate(file.fd, static_cast<off_t>(committed)) == 0) fdatasync(file.fd);
+        }
+        file.size = committed;
+        _total_bytes += committed;
+    }
+
+    // Called with _write_mutex held. Creating and syncing the file happen
+    // outside _mutex; it is taken only to publish the new file.
+    void open_active_file() {
+        uint64_t id;
+        {
+            std::unique_lock<std::shared_mutex> lock(_mutex);
+            id = _next_file_id++;
+        }
+        std::string path = file_path(id);
+        int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (fd < 0) throw std::runtime_error("Cannot open " + path + ": " + std::strerror(errno));
+        sync_dir();
+        std::unique_lock<std::shared_mutex> lock(_mutex);
+        _files[id] = DataFile{fd, 0, _next_seq};
+        _active_fd = fd;
+        _active_id = id;
+        _active_size = 0;
+    }
+
+    // Called with _write_mutex held, but not _mutex, so readers never wait
+    // on the sync. The old file stays open for reads.
+    void rotate() {
+        fdatasync(_active_fd);
+        open_active_file();
+    }
+
+    // Called with _mutex held (shared or exclusive)
+    std::string read_value(const Location& loc) {
+        const DataFile& file = _files.at(loc.file_id);
+        std::string data(loc.size, '\0');
+        size_t done = 0;
+        while (done < loc.size) {
+            ssize_t n = pread(file.fd, &data[done], loc.size - done, static_cast<off_t>(loc.offset + done));
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) throw std::runtime_error("Bitcask read failed in " + file_path(loc.file_id));
+            done += static_cast<size_t>(n);
+        }
+        auto record = decode(data, 0);
+        if (!record) throw std::runtime_error("Bitcask record corrupt in " + file_path(loc.file_id) + " at offset " + std::to_string(loc.offset));
+        return std::move(record->value);
+    }
+
+    std::optional<std::string> read_locked(const std::string& key) {
+        auto it = _keydir.find(key);
+        if (it == _keydir.end()) return std::nullopt;
+        return read_value(it->second);
+    }
+
+    bool needs_compaction() {
+        std::shared_lock<std::shared_mutex> lock(_mutex);
+        if (_files.size() < 2 || _total_bytes < _max_file_bytes) return false;
+        return static_cast<double>(_total_bytes - _live_bytes) >= _compaction_ratio * _total_bytes;
+    }
+
+    void compaction_loop() {
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(_compactor_mutex);
+                _compactor_cv.wait_for(lock, _compaction_interval, [this] { return _stopping; });
+                if (_stopping) return;
+            }
+            if (!needs_compaction()) continue;
+            try {
+                compact();
+            } catch (const std::exception& e) {
+                log_event(std::string("BITCASK: Compaction failed: ") + e.what());
+            }
+        }
+    }
+
+    // Copies the live records of every immutable data file into new files,
+    // then repoints the keydir and deletes the old files. Writers keep going
+    // meanwhile; a key they overwrite or delete before the swap keeps its
+    // newer location, and the copy is left as garbage for the next round.
+    void compact() {
+        std::vector<uint64_t> inputs;
+        {
+            std::shared_lock<std::shared_mutex> lock(_mutex);
+            for (const auto& file : _files) {
+                if (file.first != _active_id) inputs.push_back(file.first);
+            }
+        }
+        log_event("BITCASK: Compacting " + std::to_string(inputs.size()) + " data file(s)");
+
+        struct Move {
+            std::string key;
+            Location from;
+            Location to;
+        };
+        std::vector<Move> moves;
+        std::vector<std::pair<uint64_t, DataFile>> outputs;
+        int out_fd = -1;
+        uint64_t out_id = 0;
+        uint64_t out_size = 0;
+        uint64_t out_min_seq = 0;
+
+        auto finish_output = [&] {
+            if (out_fd < 0) return;
+            if (fdatasync(out_fd) != 0) throw std::runtime_error("Bitcask fsync failed: " + std::string(std::strerror(errno)));
+            outputs.emplace_back(out_id, DataFile{out_fd, out_size, out_min_seq});
+            out_fd = -1;
+        };
+
+        try {
+            for (uint64_t id : inputs) {
+                int fd;
+                {
+                    std::shared_lock<std::shared_mutex> lock(_mutex);
+                    fd = _files.at(id).fd;
+                }
+                std::string data;
+                if (!read_all(fd, data)) throw std::runtime_error("Cannot read " + file_path(id));
+
+                size_t pos = 0;
+                while (auto record = decode(data, pos)) {
+                    pos += record->size;
+                    if (record->flags & FLAG_TOMBSTONE) continue;
+                    Location from{id, record->offset, record->size, record->seq};
+                    {
+                        std::shared_lock<std::shared_mutex> lock(_mutex);
+                        auto it = _keydir.find(record->key);
+                        if (it == _keydir.end() || !(it->second == from)) continue;
+                    }
+
+                    if (out_fd >= 0 && out_size >= _max_file_bytes) finish_output();
+                    if (out_fd < 0) {
+                        {
+                            std::unique_lock<std::shared_mutex> lock(_mutex);
+                            out_id = _next_file_id++;
+                        }
+                        std::string path = file_path(out_id);
+                        out_fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+                        if (out_fd < 0) throw std::runtime_error("Cannot open " + path + ": " + std::strerror(errno));
+                        out_size = 0;
+                        out_min_seq = record->seq;
+                    }
+                    // Each copy is a complete batch of its own
+                    std::string copy = encode(record->seq, FLAG_BATCH_END, record->key, record->value);
+                    if (!write_all(out_fd, copy.data(), copy.size())) {
+                        throw std::runtime_error("Bitcask write failed: " + std::string(std::strerror(errno)));
+                    }
+                    moves.push_back(Move{record->key, from, Location{out_id, out_size, static_cast<uint32_t>(copy.size()), record->seq}});
+                    out_size += copy.size();
+                    out_min_seq = std::min(out_min_seq, record->seq);
+                }
+            }
+            finish_output();
+            sync_dir();
+        } catch (...) {
+            if (out_fd >= 0) outputs.emplace_back(out_id, DataFile{out_fd, out_size, out_min_seq});
+            for (auto& output : outputs) {
+                close(output.second.fd);
+                unlink(file_path(output.first).c_str());
+            }
+            throw;
+        }
+
+        std::vector<std::pair<uint64_t, DataFile>> retired;
+        {
+            std::unique_lock<std::shared_mutex> lock(_mutex);
+            for (auto& output : outputs) {
+                _files[output.first] = output.second;
+                _total_bytes += output.second.size;
+            }
+            for (const auto& move : moves) {
+                auto it = _keydir.find(move.key);
+                if (it != _keydir.end() && it->second == move.from) it->second = move.to;
+            }
+            for (uint64_t id : inputs) {
+                auto it = _files.find(id);
+                _total_bytes -= it->second.size;
+                retired.emplace_back(id, it->second);
+                _files.erase(it);
+            }
+        }
+
+        // Delete oldest data first: a tombstone's file must never go before a
+        // file still holding an older value of its key, or a crash in between
+        // would bring the value back
+        std::sort(retired.begin(), retired.end(), [](const auto& a, const auto& b) {
+            return a.second.min_seq < b.second.min_seq;
+        });
+        for (const auto& file : retired) {
+            close(file.second.fd);
+            unlink(file_path(file.first).c_str());
+            sync_dir();
+        }
+        log_event("BITCASK: Compaction moved " + std::to_string(moves.size()) + " live record(s) into " + std::to_string(outputs.size()) + " file(s)");
+    }
+};
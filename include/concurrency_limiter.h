@@ -0,0 +1,150 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <utility>
+#include "logger.h"
+
+// Adaptive cap on in-flight calls to a downstream (gradient-style, after
+// Netflix's Gradient2 limiter).
+//
+// Each completed call's latency feeds a short-term moving average (over a few
+// samples) and a long-term baseline (decaying over baseline_time_constant, so
+// it tracks a new normal but not a sudden slowdown). While the short-term
+// latency stays within tolerance of the baseline the limit grows by about
+// sqrt(limit) per sample; once calls slow down (queueing downstream) the ratio
+// baseline/short scales the limit down towards the knee of the latency curve.
+// The limit only grows while it is actually in use. A failed call (error,
+// timeout) also backs the limit off multiplicatively. Callers over the limit
+// are refused immediately instead of joining the queue.
+class ConcurrencyLimiter {
+public:
+    struct Options {
+        double initial_limit = 20;
+        double min_limit = 4;
+        double max_limit = 200;
+        double smoothing = 0.2; // Weight of each new limit estimate
+        double tolerance = 2.0; // Short-term latency may reach this multiple of the baseline before shrinking
+        size_t short_window = 10; // Samples in the short-term latency average
+        std::chrono::milliseconds baseline_time_constant{30000}; // Decay time of the baseline latency
+        double backoff = 0.9; // Limit multiplier after a failed call
+    };
+
+    // RAII slot: releasing it records the call's latency (or a failure)
+    class Permit {
+    public:
+        Permit(ConcurrencyLimiter* limiter, size_t in_flight)
+            : _limiter(limiter), _in_flight(in_flight), _start(std::chrono::steady_clock::now()) {}
+        Permit(Permit&& other) noexcept
+            : _limiter(other._limiter), _in_flight(other._in_flight), _start(other._start), _failed(other._failed) {
+            other._limiter = nullptr;
+        }
+        Permit(const Permit&) = delete;
+        Permit& operator=(const Permit&) = delete;
+        Permit& operator=(Permit&&) = delete;
+
+        ~Permit() {
+            if (_limiter) _limiter->release(std::chrono::steady_clock::now() - _start, _in_flight, _failed);
+        }
+
+        // The call failed: back off instead of sampling its latency
+        void failed() { _failed = true; }
+
+    private:
+        ConcurrencyLimiter* _limiter;
+        size_t _in_flight; // Calls in flight when this one started, itself included
+        std::chrono::steady_clock::time_point _start;
+        bool _failed = false;
+    };
+
+    explicit ConcurrencyLimiter(const Options& options) : _options(options), _limit(options.initial_limit) {}
+
+    ConcurrencyLimiter(const ConcurrencyLimiter&) = delete;
+    ConcurrencyLimiter& operator=(const ConcurrencyLimiter&) = delete;
+
+    // A permit, or std::nullopt if the limit is reached
+    std::optional<Permit> try_acquire() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_in_flight >= static_cast<size_t>(_limit)) {
+            ++_rejected;
+            return std::nullopt;
+        }
+        ++_in_flight;
+        return Permit(this, _in_flight);
+    }
+
+    size_t limit() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return static_cast<size_t>(_limit);
+    }
+
+    size_t in_flight() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _in_flight;
+    }
+
+    uint64_t rejected() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _rejected;
+    }
+
+    // Baseline and recent latency in microseconds (0 before the first sample)
+    std::pair<double, double> latency_us() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return {_long_rtt, _short_rtt};
+    }
+
+private:
+    Options _options;
+    double _limit;
+    double _short_rtt = 0;
+    double _long_rtt = 0;
+    size_t _in_flight = 0;
+    uint64_t _rejected = 0;
+    std::mutex _mutex;
+
+    std::chrono::steady_clock::time_point _last_sample;
+
+    static double ema(double average, double sample, double alpha) {
+        if (average == 0) return sample;
+        return average + alpha * (sample - average);
+    }
+
+    void release(std::chrono::steady_clock::duration elapsed, size_t in_flight, bool failed) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        --_in_flight;
+        size_t old_limit = static_cast<size_t>(_limit);
+
+        if (failed) {
+            _limit = std::max(_options.min_limit, _limit * _options.backoff);
+        } else {
+            auto now = std::chrono::steady_clock::now();
+            double rtt = std::chrono::duration<double, std::micro>(elapsed).count();
+            double since_last = std::chrono::duration<double>(now - _last_sample).count();
+            double time_constant = std::chrono::duration<double>(_options.baseline_time_constant).count();
+            _last_sample = now;
+            _short_rtt = ema(_short_rtt, rtt, 2.0 / (static_cast<double>(_options.short_window) + 1.0));
+            _long_rtt = ema(_long_rtt, rtt, 1.0 - std::exp(-since_last / time_constant));
+            // Let the baseline recover quickly after a long slow period ends
+            if (_long_rtt > 2 * _short_rtt) _long_rtt *= 0.95;
+
+            double gradient = std::clamp(_options.tolerance * _long_rtt / _short_rtt, 0.5, 1.0);
+            double estimate = _limit * gradient + std::sqrt(_limit);
+            // Too little traffic to tell whether a higher limit would still be fine
+            bool app_limited = static_cast<double>(in_flight) < _limit / 2;
+            if (app_limited && estimate >= _limit) return;
+
+            _limit = (1 - _options.smoothing) * _limit + _options.smoothing * estimate;
+            _limit = std::clamp(_limit, _options.min_limit, _options.max_limit);
+        }
+
+        size_t new_limit = static_cast<size_t>(_limit);
+        if (new_limit != old_limit) {
+            log_event("LIMITER: Concurrency limit " + std::to_string(old_limit) + " -> " + std::to_string(new_limit));
+        }
+    }
+};
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <pqxx/pqxx>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include "logger.h"
+
+// Fixed-size, thread-safe pool of PostgreSQL connections.
+//
+// Slots start empty and are connected lazily on first checkout. A checked-out
+// connection that was idle longer than the health-check interval is pinged
+// first; a connection found closed or broken (after a pqxx::broken_connection
+// or a failed ping) is dropped and its slot reconnects on next use. The
+// optional on_connect hook runs once per new connection, e.g. to prepare
+// statements.
+class DBConnectionPool {
+public:
+    // RAII checkout: returns the connection to the pool when destroyed
+    class Lease {
+    public:
+        Lease(DBConnectionPool* pool, std::unique_ptr<pqxx::connection> conn)
+            : _pool(pool), _conn(std::move(conn)) {}
+        Lease(Lease&& other) noexcept : _pool(other._pool), _conn(std::move(other._conn)), _broken(other._broken) {
+            other._pool = nullptr;
+        }
+        Lease(const Lease&) = delete;
+        Lease& operator=(const Lease&) = delete;
+        Lease& operator=(Lease&&) = delete;
+
+        ~Lease() {
+            if (_pool) _pool->release(std::move(_conn), _broken);
+        }
+
+        pqxx::connection& operator*() { return *_conn; }
+        pqxx::connection* operator->() { return _conn.get(); }
+
+        // Discard this connection instead of returning it to the pool
+        void mark_broken() { _broken = true; }
+
+    private:
+        DBConnectionPool* _pool;
+        std::unique_ptr<pqxx::connection> _conn;
+        bool _broken = false;
+    };
+
+    DBConnectionPool(const std::string& connection_string, size_t size,
+                     std::chrono::milliseconds wait_timeout,
+                     std::chrono::milliseconds health_check_idle,
+                     std::function<void(pqxx::connection&)> on_connect = nullptr)
+        : _connection_string(connection_string),
+          _size(size),
+          _wait_timeout(wait_timeout),
+          _health_check_idle(health_check_idle),
+          _on_connect(std::move(on_connect)) {
+        for (size_t i = 0; i < size; ++i) _idle.push_back(Slot{});
+    }
+
+    // Check out a connection, waiting up to the configured timeout for one to
+    // be returned. Throws std::runtime_error on timeout and pqxx exceptions if
+    // (re)connecting fails.
+    Lease acquire() {
+        Slot slot;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            if (!_available.wait_for(lock, _wait_timeout, [this] { return !_idle.empty(); })) {
+                throw std::runtime_error("Timed out waiting for a database connection");
+            }
+            // LIFO keeps recently used connections warm and lets idle ones age out
+            slot = std::move(_idle.back());
+            _idle.pop_back();
+        }
+
+        try {
+            if (slot.conn && !healthy(slot)) {
+                log_event("DB POOL: Dropping unhealthy connection");
+                slot.conn.reset();
+            }
+            if (!slot.conn) {
+                log_event("Creating new database connection");
+                slot.conn = std::make_unique<pqxx::connection>(_connection_string);
+                if (_on_connect) _on_connect(*slot.conn);
+            }
+        } catch (...) {
+            release(nullptr, true);
+            throw;
+        }
+        return Lease(this, std::move(slot.conn));
+    }
+
+    size_t size() const { return _size; }
+
+    // Connections currently checked in (connected or not)
+    size_t idle() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _idle.size();
+    }
+
+private:
+    struct Slot {
+        std::unique_ptr<pqxx::connection> conn; // null until connected
+        std::chrono::steady_clock::time_point last_used;
+    };
+
+    std::string _connection_string;
+    size_t _size;
+    std::chrono::milliseconds _wait_timeout;
+    std::chrono::milliseconds _health_check_idle;
+    std::function<void(pqxx::connection&)> _on_connect;
+    std::deque<Slot> _idle;
+    std::mutex _mutex;
+    std::condition_variable _available;
+
+    bool healthy(Slot& slot) {
+        if (!slot.conn->is_open()) return false;
+        if (std::chrono::steady_clock::now() - slot.last_used < _health_check_idle) return true;
+        try {
+            pqxx::nontransaction ping(*slot.conn);
+            ping.exec("SELECT 1");
+            return true;
+        } catch (const std::exception&) {
+            return false;
+        }
+    }
+
+    void release(std::unique_ptr<pqxx::connection> conn, bool broken) {
+        if (conn && (broken || !conn->is_open())) {
+            log_event("DB POOL: Discarding broken connection");
+            conn.reset();
+        }
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _idle.push_back(Slot{std::move(conn), std::chrono::steady_clock::now()});
+        }
+        _available.notify_one();
+    }
+};
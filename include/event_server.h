@@ -0,0 +1,1045 @@
+#pragma once
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <regex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "httplib.h"
+#include "logger.h"
+
+// Event-driven HTTP/1.1 front end: a few I/O threads multiplex every client
+// connection, and handlers run on a worker pool once a request has arrived
+// (or, for ContentReader routes, its head).
+//
+// httplib::Server gives each connection a pool thread for as long as it
+// stays open, so SERVER_THREAD_COUNT keep-alive clients starve everyone else
+// even while idle. Here each I/O thread owns a SO_REUSEPORT listening socket
+// and an epoll set; connections are non-blocking and edge-triggered, and each
+// keeps its own parser state and buffers, so an idle or slow connection costs
+// memory but no thread. A complete request is handed to a worker, whose
+// response is written straight to the socket when it fits and otherwise left
+// for the I/O thread to send on EPOLLOUT.
+//
+// Handlers take the same httplib::Request/Response as on httplib::Server, so
+// one set of routes serves either front end. An asynchronous handler gets a
+// done callback as well and may return before the response is ready: it
+// hands the work on (e.g. to a batcher) and whoever completes it fills in
+// the response and calls done, which writes it from that thread. No thread
+// waits for the backend in between. Request bodies (Content-Length or
+// chunked) are buffered up to max_body_bytes before dispatch, except on
+// ContentReader routes: those are dispatched once the head has arrived, and
+// the reader gets the body chunk by chunk as the I/O thread parses it, which
+// stops reading the socket while more than read_buffer_bytes wait for the
+// handler. Streamed responses (content providers) run on the worker and
+// pause while more than write_buffer_bytes are waiting for a slow client.
+// One request per connection is handled at a time; pipelined requests queue
+// behind it.
+class EventServer {
+public:
+    using Handler = httplib::Server::Handler;
+    using HandlerWithContentReader = httplib::Server::HandlerWithContentReader;
+    // Call exactly once, from any thread, once the response is filled in; the
+    // request and response stay valid until then
+    using Done = std::function<void()>;
+    using AsyncHandler = std::function<void(const httplib::Request&, httplib::Response&, Done)>;
+
+    struct Options {
+        size_t io_threads = 2;
+        size_t worker_threads = 16; // Threads running handlers
+        size_t max_connections = 10000; // Per I/O thread; further connections are closed at once
+        size_t max_header_bytes = 64 * 1024; // Request line and headers
+        size_t max_body_bytes = 1024 * 1024; // Buffered bodies; ContentReader routes stream theirs
+        std::chrono::milliseconds idle_timeout{60000}; // Close connections without a request in progress
+        size_t read_buffer_bytes = 1024 * 1024; // Streamed body bytes waiting for the handler that pause reading
+        size_t write_buffer_bytes = 1024 * 1024; // Unsent bytes that pause a streamed response
+    };
+
+    // Incremental HTTP/1.1 request parser, fed whatever has arrived so far.
+    //
+    // A request whose head passes stream_body has its body streamed: parse()
+    // returns Head once the head is in, and the body then collects in
+    // take_body() instead of the request, with no max_body_bytes limit.
+    class RequestParser {
+    public:
+        enum class Result { NeedMore, Head, Complete, Error };
+        using StreamBody = std::function<bool(const httplib::Request&)>;
+
+        RequestParser(size_t max_header_bytes, size_t max_body_bytes, StreamBody stream_body = nullptr)
+            : _max_header_bytes(max_header_bytes), _max_body_bytes(max_body_bytes),
+              _stream_body(std::move(stream_body)) {}
+
+        // Consume in from pos on. Head: head() returns the request so far,
+        // and parsing goes on with its body. Complete: take() returns the
+        // request. Error: error_status() is the status to answer before
+        // closing.
+        Result parse(const std::string& in, size_t& pos) {
+            for (;;) {
+                switch (_state) {
+                    case State::Head: {
+                        size_t end = in.find("\r\n\r\n", pos + _scanned);
+                        if (end == std::string::npos) {
+                            if (in.size() - pos > _max_header_bytes) return fail(431); // Request Header Fields Too Large
+                            _scanned = std::max<size_t>(in.size() - pos, 3) - 3;
+                            return Result::NeedMore;
+                        }
+                        if (end - pos > _max_header_bytes) return fail(431);
+                        if (!parse_head(in.substr(pos, end - pos))) return Result::Error;
+                        pos = end + 4;
+                        _scanned = 0;
+                        if (_chunked) {
+                            _state = State::ChunkSize;
+                        } else if (_remaining > 0) {
+                            _state = State::Body;
+                        } else {
+                            return Result::Complete;
+                        }
+                        if (_streaming) return Result::Head;
+                        break;
+                    }
+                    case State::Body:
+                    case State::ChunkData: {
+                        size_t n = std::min(_remaining, in.size() - pos);
+                        (_streaming ? _streamed : _request->body).append(in, pos, n);
+                        _body_bytes += n;
+                        pos += n;
+                        _remaining -= n;
+                        if (_remaining > 0) return Result::NeedMore;
+                        if (_state == State::Body) return Result::Complete;
+                        if (in.size() - pos < 2) return Result::NeedMore;
+                        if (in.compare(pos, 2, "\r\n") != 0) return fail(400);
+                        pos += 2;
+                        _state = State::ChunkSize;
+                        break;
+                    }
+                    case State::ChunkSize: {
+                        size_t eol = in.find("\r\n", pos);
+                        if (eol == std::string::npos) {
+                            if (in.size() - pos > 1024) return fail(400);
+                            return Result::NeedMore;
+                        }
+                        // Hex size, optionally followed by ;extensions (ignored)
+                        size_t size = 0;
+                        size_t i = pos;
+                        for (; i < eol && std::isxdigit(static_cast<unsigned char>(in[i])); ++i) {
+                            if (size > (SIZE_MAX >> 4)) return fail(400);
+                            char c = static_cast<char>(std::tolower(static_cast<unsigned char>(in[i])));
+                            size = size * 16 + static_cast<size_t>(c <= '9' ? c - '0' : c - 'a' + 10);
+                        }
+                        if (i == pos || (i < eol && in[i] != ';' && in[i] != ' ' && in[i] != '\t')) return fail(400);
+                        pos = eol + 2;
+                        if (size == 0) {
+                            _state = State::Trailer;
+                            break;
+                        }
+                        if (!_streaming && size > _max_body_bytes - _body_bytes) return fail(413); // Payload Too Large
+                        _remaining = size;
+                        _state = State::ChunkData;
+                        break;
+                    }
+                    case State::Trailer: {
+                        // Trailer fields are skipped up to the empty line
+                        size_t eol = in.find("\r\n", pos);
+                        if (eol == std::string::npos) {
+                            if (in.size() - pos > _max_header_bytes) return fail(431);
+                            return Result::NeedMore;
+                        }
+                        bool last = eol == pos;
+                        pos = eol + 2;
+                        if (last) return Result::Complete;
+                        break;
+                    }
+                }
+            }
+        }
+
+        // The completed request; resets the parser for the next one
+        std::shared_ptr<httplib::Request> take() {
+            _state = State::Head;
+            _chunked = false;
+            _remaining = 0;
+            _body_bytes = 0;
+            _streaming = false;
+            _expect_continue = false;
+            return std::move(_request);
+        }
+
+        // After Head: the request with an empty body. The parser no longer
+        // touches it, so it may go to another thread.
+        std::shared_ptr<httplib::Request> head() const { return _request; }
+
+        // Streamed body bytes parsed since the last call
+        std::string take_body() { return std::exchange(_streamed, std::string()); }
+
+        // Whether the connection stays open after the request taken last
+        bool keep_alive() const { return _keep_alive; }
+
+        int error_status() const { return _error_status; }
+
+        // True once per request whose client sent "Expect: 100-continue" and
+        // waits for an interim response before sending the body
+        bool take_expect_continue() { return std::exchange(_expect_continue, false); }
+
+    private:
+        enum class State { Head, Body, ChunkSize, ChunkData, Trailer };
+
+        size_t _max_header_bytes;
+        size_t _max_body_bytes;
+        StreamBody _stream_body;
+        State _state = State::Head;
+        size_t _scanned = 0; // Head: bytes after pos already searched for the blank line
+        std::shared_ptr<httplib::Request> _request;
+        bool _chunked = false;
+        size_t _remaining = 0; // Body bytes still due (Content-Length or current chunk)
+        size_t _body_bytes = 0; // Body bytes parsed so far
+        bool _streaming = false;
+        std::string _streamed; // Streamed body bytes not yet taken
+        bool _keep_alive = true;
+        bool _expect_continue = false;
+        int _error_status = 0;
+
+        Result fail(int status) {
+            _error_status = status;
+            return Result::Error;
+        }
+
+        bool reject(int status) {
+            _error_status = status;
+            return false;
+        }
+
+        static std::string lower(std::string s) {
+            for (auto& c : s) c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+            return s;
+        }
+
+        bool parse_head(const std::string& head) {
+            _request = std::make_shared<httplib::Request>();
+            auto& req = *_request;
+
+            size_t line_end = std::min(head.find("\r\n"), head.size());
+            std::string line = head.substr(0, line_end);
+            size_t sp1 = line.find(' ');
+            size_t sp2 = sp1 == std::string::npos ? sp1 : line.find(' ', sp1 + 1);
+            if (sp2 == std::string::npos || line.find(' ', sp2 + 1) != std::string::npos) return reject(400);
+            req.method = line.substr(0, sp1);
+            req.target = line.substr(sp1 + 1, sp2 - sp1 - 1);
+            req.version = line.substr(sp2 + 1);
+            if (req.method.empty() || req.target.empty() || req.target[0] != '/') return reject(400);
+            if (req.version != "HTTP/1.1" && req.version != "HTTP/1.0") return reject(505); // HTTP Version Not Supported
+
+            size_t query = req.target.find('?');
+            req.path = httplib::decode_path_component(req.target.substr(0, query));
+            if (query != std::string::npos) httplib::detail::parse_query_text(req.target.substr(query + 1), req.params);
+
+            for (size_t start = line_end + 2; start < head.size();) {
+                size_t end = std::min(head.find("\r\n", start), head.size());
+                std::string field = head.substr(start, end - start);
+                start = end + 2;
+                size_t colon = field.find(':');
+                if (colon == 0 || colon == std::string::npos ||
+                    field.find_first_of(" \t") < colon) {
+                    return reject(400);
+                }
+                size_t value_start = field.find_first_not_of(" \t", colon + 1);
+                size_t value_end = field.find_last_not_of(" \t");
+                std::string value = value_start == std::string::npos ? ""
+                                    : field.substr(value_start, value_end - value_start + 1);
+                req.headers.emplace(field.substr(0, colon), std::move(value));
+            }
+
+            std::string connection = lower(req.get_header_value("Connection"));
+            _keep_alive = req.version == "HTTP/1.1" ? connection.find("close") == std::string::npos
+                                                    : connection.find("keep-alive") != std::string::npos;
+
+            // Both framings at once is how requests get smuggled past proxies
+            if (req.has_header("Transfer-Encoding")) {
+                if (lower(req.get_header_value("Transfer-Encoding")) != "chunked") return reject(501); // Not Implemented
+                if (req.has_header("Content-Length")) return reject(400);
+                _chunked = true;
+            } else if (req.has_header("Content-Length")) {
+                std::string length = req.get_header_value("Content-Length");
+                if (req.get_header_value_count("Content-Length") > 1 || length.empty() || length.size() > 19 ||
+                    length.find_first_not_of("0123456789") != std::string::npos) {
+                    return reject(400);
+                }
+                _remaining = std::stoull(length);
+            }
+            bool has_body = _chunked || _remaining > 0;
+            _streaming = has_body && _stream_body && _stream_body(req);
+            if (!_streaming && _remaining > _max_body_bytes) return reject(413);
+            _expect_continue = has_body && lower(req.get_header_value("Expect")) == "100-continue";
+            return true;
+        }
+    };
+
+    explicit EventServer(const Options& options) : _options(options) {}
+
+    ~EventServer() { stop(); }
+
+    EventServer(const EventServer&) = delete;
+    EventServer& operator=(const EventServer&) = delete;
+
+    // Routes, tried in registration order; patterns must match the whole path
+    EventServer& Get(const std::string& pattern, Handler handler) { return route("GET", pattern, std::move(handler)); }
+    EventServer& Post(const std::string& pattern, Handler handler) { return route("POST", pattern, std::move(handler)); }
+    EventServer& Post(const std::string& pattern, HandlerWithContentReader handler) {
+        return route("POST", pattern, nullptr, std::move(handler));
+    }
+    EventServer& Put(const std::string& pattern, Handler handler) { return route("PUT", pattern, std::move(handler)); }
+    EventServer& Put(const std::string& pattern, HandlerWithContentReader handler) {
+        return route("PUT", pattern, nullptr, std::move(handler));
+    }
+    EventServer& Delete(const std::string& pattern, Handler handler) {
+        return route("DELETE", pattern, std::move(handler));
+    }
+    EventServer& GetAsync(const std::string& pattern, AsyncHandler handler) {
+        return route("GET", pattern, nullptr, nullptr, std::move(handler));
+    }
+    EventServer& PostAsync(const std::string& pattern, AsyncHandler handler) {
+        return route("POST", pattern, nullptr, nullptr, std::move(handler));
+    }
+    EventServer& PutAsync(const std::string& pattern, AsyncHandler handler) {
+        return route("PUT", pattern, nullptr, nullptr, std::move(handler));
+    }
+    EventServer& DeleteAsync(const std::string& pattern, AsyncHandler handler) {
+        return route("DELETE", pattern, nullptr, nullptr, std::move(handler));
+    }
+
+    // Serve until stop(); the calling thread runs the first I/O loop. False
+    // if the address cannot be bound.
+    bool listen(const std::string& host, int port) {
+        {
+            std::lock_guard<std::mutex> lock(_loops_mutex);
+            for (size_t i = 0; i < std::max<size_t>(_options.io_threads, 1); ++i) {
+                auto loop = std::make_unique<Loop>();
+                loop->listen_fd = bind_socket(host, port);
+                loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+                loop->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+                _loops.push_back(std::move(loop));
+                if (_loops.back()->listen_fd < 0 || !watch(*_loops.back(), _loops.back()->listen_fd, EPOLLIN) ||
+                    !watch(*_loops.back(), _loops.back()->wake_fd, EPOLLIN)) {
+                    std::cerr << "Event server failed to listen on " << host << ":" << port << ": "
+                              << std::strerror(errno) << std::endl;
+                    close_loops();
+                    return false;
+                }
+            }
+        }
+        _pool = std::make_unique<httplib::ThreadPool>(std::max<size_t>(_options.worker_threads, 1));
+        log_event("EVENT SERVER: Listening on " + host + ":" + std::to_string(port) + " with " +
+                  std::to_string(_loops.size()) + " I/O thread(s) and " + std::to_string(_options.worker_threads) +
+                  " worker(s)");
+
+        std::vector<std::thread> threads;
+        for (size_t i = 1; i < _loops.size(); ++i) threads.emplace_back([this, i] { run(*_loops[i]); });
+        run(*_loops[0]);
+        for (auto& thread : threads) thread.join();
+
+        // Loops must outlive the workers and asynchronous handlers, which
+        // post finished requests to them
+        _pool->shutdown();
+        {
+            std::unique_lock<std::mutex> lock(_in_flight_mutex);
+            _in_flight_done.wait(lock, [this] { return _in_flight == 0; });
+        }
+        _pool.reset();
+        std::lock_guard<std::mutex> lock(_loops_mutex);
+        close_loops();
+        return true;
+    }
+
+    void stop() {
+        _stopping = true;
+        std::lock_guard<std::mutex> lock(_loops_mutex);
+        for (auto& loop : _loops) wake(*loop);
+    }
+
+private:
+    struct Loop;
+
+    struct Route {
+        std::string method;
+        std::regex pattern;
+        Handler handler;
+        HandlerWithContentReader reader_handler;
+        AsyncHandler async_handler;
+    };
+
+    // Body of a request on a ContentReader route, passed from the I/O thread
+    // that parses it to the worker running the handler
+    class BodyStream {
+    public:
+        // resume: called (from the worker) when reading may go on after push()
+        // filled the buffer
+        BodyStream(size_t buffer_bytes, std::function<void()> resume)
+            : _buffer_bytes(buffer_bytes), _resume(std::move(resume)) {}
+
+        // I/O thread: queue parsed body bytes
+        void push(std::string data) {
+            if (data.empty()) return;
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (_released || _failed) return; // Nobody reads them any more
+            _data += data;
+            if (_data.size() >= _buffer_bytes) _paused = true;
+            _ready.notify_all();
+        }
+
+        // I/O thread: whether to stop reading the socket until resume
+        bool paused() {
+            std::lock_guard<std::mutex> lock(_mutex);
+            return _paused;
+        }
+
+        // I/O thread: the whole body has been parsed
+        void end() {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _ended = true;
+            _ready.notify_all();
+        }
+
+        // I/O thread: the body was cut short (connection lost or malformed)
+        void fail() {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _failed = true;
+            _ready.notify_all();
+        }
+
+        // Worker: pass the body to receiver as it arrives. False if the body
+        // was cut short or receiver asked to stop.
+        bool read(const httplib::ContentReceiver& receiver) {
+            for (;;) {
+                std::string data;
+                bool resume;
+                {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    _ready.wait(lock, [this] { return !_data.empty() || _ended || _failed; });
+                    if (_failed) return false;
+                    if (_data.empty()) return true; // Ended
+                    data.swap(_data);
+                    resume = std::exchange(_paused, false);
+                }
+                if (resume) _resume();
+                if (!receiver(data.data(), data.size())) return false;
+            }
+        }
+
+        // Worker, once the handler is done: true if the whole body arrived,
+        // so the connection can serve the next request. Otherwise the rest
+        // of the body is dropped and the connection must close.
+        bool release() {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _released = true;
+            _data.clear();
+            return _ended && !_failed;
+        }
+
+    private:
+        size_t _buffer_bytes;
+        std::function<void()> _resume;
+        std::mutex _mutex;
+        std::condition_variable _ready;
+        std::string _data; // Parsed, not yet read
+        bool _paused = false;
+        bool _ended = false;
+        bool _failed = false;
+        bool _released = false;
+    };
+
+    struct Connection {
+        Connection(int fd, Loop* loop, const Options& options, RequestParser::StreamBody stream_body)
+            : fd(fd), loop(loop), parser(options.max_header_bytes, options.max_body_bytes, std::move(stream_body)) {}
+
+        int fd;
+        Loop* loop; // The I/O thread that owns the connection
+        std::string remote_addr;
+        int remote_port = 0;
+
+        // Owned by the I/O thread
+        std::string in;
+        size_t parsed = 0; // Bytes of in already consumed by the parser
+        RequestParser parser;
+        bool open = true;
+        bool busy = false; // A worker is handling a request
+        std::shared_ptr<BodyStream> stream; // Body still arriving for the busy request
+        bool peer_closed = false;
+        bool close_after = false; // Close once out is sent
+        std::chrono::steady_clock::time_point last_active;
+
+        // Shared with the worker. The fd is only closed with broken set, so a
+        // worker that sees broken clear under the mutex may write to it.
+        std::mutex mutex;
+        std::condition_variable drained;
+        std::string out; // Waiting for EPOLLOUT
+        bool broken = false;
+    };
+
+    struct Finished {
+        std::shared_ptr<Connection> connection;
+        bool close;
+    };
+
+    struct Loop {
+        int listen_fd = -1;
+        int epoll_fd = -1;
+        int wake_fd = -1;
+        std::unordered_map<int, std::shared_ptr<Connection>> connections;
+
+        std::mutex mutex;
+        std::vector<Finished> finished; // Requests workers are done with
+        std::vector<std::shared_ptr<Connection>> resumed; // Streamed bodies ready for more input
+    };
+
+    Options _options;
+    std::vector<Route> _routes;
+    std::vector<std::unique_ptr<Loop>> _loops;
+    std::mutex _loops_mutex;
+    std::unique_ptr<httplib::ThreadPool> _pool;
+    std::atomic<bool> _stopping{false};
+    // Requests handed to a worker and not yet back on their I/O thread
+    std::mutex _in_flight_mutex;
+    std::condition_variable _in_flight_done;
+    size_t _in_flight = 0;
+
+    EventServer& route(const std::string& method, const std::string& pattern, Handler handler,
+                       HandlerWithContentReader reader_handler = nullptr, AsyncHandler async_handler = nullptr) {
+        _routes.push_back(Route{method, std::regex(pattern), std::move(handler), std::move(reader_handler),
+                                std::move(async_handler)});
+        return *this;
+    }
+
+    static int bind_socket(const std::string& host, int port) {
+        addrinfo hints{};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_PASSIVE | AI_NUMERICSERV;
+        addrinfo* addresses = nullptr;
+        if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &addresses) != 0) return -1;
+
+        int fd = -1;
+        for (addrinfo* a = addresses; a && fd < 0; a = a->ai_next) {
+            fd = socket(a->ai_family, a->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, a->ai_protocol);
+            if (fd < 0) continue;
+            int one = 1;
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+            // One socket per I/O thread; the kernel spreads connections across them
+            setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+            if (bind(fd, a->ai_addr, a->ai_addrlen) != 0 || ::listen(fd, SOMAXCONN) != 0) {
+                ::close(fd);
+                fd = -1;
+            }
+        }
+        freeaddrinfo(addresses);
+        return fd;
+    }
+
+    static bool watch(Loop& loop, int fd, uint32_t events) {
+        epoll_event event{};
+        event.events = events;
+        event.data.fd = fd;
+        return epoll_ctl(loop.epoll_fd, EPOLL_CTL_ADD, fd, &event) == 0;
+    }
+
+    static void wake(Loop& loop) {
+        uint64_t one = 1;
+        (void)!::write(loop.wake_fd, &one, sizeof(one));
+    }
+
+    void close_loops() {
+        for (auto& loop : _loops) {
+            for (int fd : {loop->listen_fd, loop->epoll_fd, loop->wake_fd}) {
+                if (fd >= 0) ::close(fd);
+            }
+        }
+        _loops.clear();
+    }
+
+    void run(Loop& loop) {
+        epoll_event events[256];
+        auto last_sweep = std::chrono::steady_clock::now();
+        while (!_stopping) {
+            int ready = epoll_wait(loop.epoll_fd, events, 256, 1000);
+            if (ready < 0 && errno != EINTR) {
+                log_event(std::string("EVENT SERVER: epoll_wait failed: ") + std::strerror(errno));
+                break;
+            }
+            for (int i = 0; i < ready; ++i) {
+                int fd = events[i].data.fd;
+                if (fd == loop.listen_fd) {
+                    accept_all(loop);
+                } else if (fd == loop.wake_fd) {
+                    uint64_t count;
+                    (void)!::read(loop.wake_fd, &count, sizeof(count));
+                    std::vector<Finished> finished;
+                    std::vector<std::shared_ptr<Connection>> resumed;
+                    {
+                        std::lock_guard<std::mutex> lock(loop.mutex);
+                        finished.swap(loop.finished);
+                        resumed.swap(loop.resumed);
+                    }
+                    for (auto& conn : resumed) {
+                        if (conn->open) on_readable(loop, conn);
+                    }
+                    for (auto& f : finished) finish(loop, f);
+                } else {
+                    auto it = loop.connections.find(fd);
+                    if (it == loop.connections.end()) continue;
+                    auto conn = it->second; // Closing erases the map's reference
+                    if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                        close(loop, conn);
+                        continue;
+                    }
+                    if (events[i].events & EPOLLOUT) flush(loop, conn);
+                    if (conn->open && (events[i].events & (EPOLLIN | EPOLLRDHUP))) on_readable(loop, conn);
+                }
+            }
+
+            auto now = std::chrono::steady_clock::now();
+            if (now - last_sweep >= std::chrono::seconds(1)) {
+                last_sweep = now;
+                std::vector<std::shared_ptr<Connection>> idle;
+                for (const auto& entry : loop.connections) {
+                    const auto& conn = entry.second;
+                    // A stalled upload counts too, unless it waits for its handler
+                    bool waiting = !conn->busy || (conn->stream && !conn->stream->paused());
+                    if (waiting && now - conn->last_active > _options.idle_timeout) idle.push_back(conn);
+                }
+                for (const auto& conn : idle) close(loop, conn);
+            }
+        }
+
+        std::vector<std::shared_ptr<Connection>> remaining;
+        for (const auto& entry : loop.connections) remaining.push_back(entry.second);
+        for (const auto& conn : remaining) close(loop, conn);
+    }
+
+    void accept_all(Loop& loop) {
+        for (;;) {
+            sockaddr_storage addr{};
+            socklen_t addr_len = sizeof(addr);
+            int fd = accept4(loop.listen_fd, reinterpret_cast<sockaddr*>(&addr), &addr_len,
+                             SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) {
+                if (errno == EINTR || errno == ECONNABORTED) continue;
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    log_event(std::string("EVENT SERVER: accept failed: ") + std::strerror(errno));
+                }
+                return;
+            }
+            if (loop.connections.size() >= _options.max_connections) {
+                ::close(fd);
+                continue;
+            }
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+            auto conn = std::make_shared<Connection>(fd, &loop, _options,
+                                                     [this](const httplib::Request& req) { return streams_body(req); });
+            char host[INET6_ADDRSTRLEN] = "";
+            if (addr.ss_family == AF_INET) {
+                auto* in = reinterpret_cast<sockaddr_in*>(&addr);
+                inet_ntop(AF_INET, &in->sin_addr, host, sizeof(host));
+                conn->remote_port = ntohs(in->sin_port);
+            } else if (addr.ss_family == AF_INET6) {
+                auto* in6 = reinterpret_cast<sockaddr_in6*>(&addr);
+                inet_ntop(AF_INET6, &in6->sin6_addr, host, sizeof(host));
+                conn->remote_port = ntohs(in6->sin6_port);
+            }
+            conn->remote_addr = host;
+            conn->last_active = std::chrono::steady_clock::now();
+
+            if (!watch(loop, fd, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET)) {
+                ::close(fd);
+                continue;
+            }
+            loop.connections.emplace(fd, std::move(conn));
+        }
+    }
+
+    // Read until the socket is drained (edge-triggered), parsing as bytes arrive
+    void on_readable(Loop& loop, const std::shared_ptr<Connection>& conn) {
+        char buffer[64 * 1024];
+        for (;;) {
+            if ((!conn->busy || conn->stream) && !conn->close_after) {
+                parse(loop, conn);
+                if (!conn->open) return;
+            }
+            if (conn->peer_closed) break;
+            // The handler lags behind a streamed body; its resume reads on
+            if (conn->stream && conn->stream->paused()) return;
+            // Pipelined input waits for the current response; finish() reads on
+            if (conn->busy && conn->in.size() - conn->parsed >= _options.max_header_bytes) return;
+
+            ssize_t n = ::recv(conn->fd, buffer, sizeof(buffer), 0);
+            if (n > 0) {
+                conn->last_active = std::chrono::steady_clock::now();
+                if (conn->close_after) continue; // Answered with an error; the rest is ignored
+                conn->in.append(buffer, static_cast<size_t>(n));
+            } else if (n == 0) {
+                conn->peer_closed = true;
+            } else if (errno != EINTR) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK) close(loop, conn);
+                return;
+            }
+        }
+        // Nothing more can arrive: close once the last response is out
+        if (conn->stream) {
+            conn->stream->fail();
+            conn->stream.reset();
+        }
+        if (!conn->busy) close_when_sent(loop, conn);
+    }
+
+    void parse(Loop& loop, const std::shared_ptr<Connection>& conn) {
+        auto result = conn->parser.parse(conn->in, conn->parsed);
+        if (conn->parsed == conn->in.size()) {
+            conn->in.clear();
+            conn->parsed = 0;
+        } else if (conn->parsed >= 64 * 1024) {
+            conn->in.erase(0, conn->parsed);
+            conn->parsed = 0;
+        }
+
+        if (conn->stream) conn->stream->push(conn->parser.take_body());
+
+        if (result == RequestParser::Result::NeedMore) {
+            if (conn->parser.take_expect_continue()) send(*conn, "HTTP/1.1 100 Continue\r\n\r\n");
+        } else if (result == RequestParser::Result::Error) {
+            if (conn->stream) {
+                // The handler sees the body cut short and answers; then close
+                conn->stream->fail();
+                conn->stream.reset();
+                conn->close_after = true;
+                return;
+            }
+            int status = conn->parser.error_status();
+            send(*conn, "HTTP/1.1 " + std::to_string(status) + " " + httplib::status_message(status) +
+                            "\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+            close_when_sent(loop, conn);
+        } else if (result == RequestParser::Result::Head) {
+            std::weak_ptr<Connection> weak = conn;
+            auto stream = std::make_shared<BodyStream>(_options.read_buffer_bytes, [weak] {
+                auto conn = weak.lock();
+                if (!conn) return;
+                {
+                    std::lock_guard<std::mutex> lock(conn->loop->mutex);
+                    conn->loop->resumed.push_back(conn);
+                }
+                wake(*conn->loop);
+            });
+            // Before the handler can answer, which would end the exchange
+            if (conn->parser.take_expect_continue()) send(*conn, "HTTP/1.1 100 Continue\r\n\r\n");
+            start(loop, conn, conn->parser.head(), conn->parser.keep_alive(), stream);
+            if (conn->open) parse(loop, conn); // Body bytes that came with the head
+        } else if (conn->stream) {
+            // End of a streamed body; the request is already with a worker
+            conn->stream->end();
+            conn->stream.reset();
+            conn->parser.take();
+        } else {
+            bool keep_alive = conn->parser.keep_alive();
+            start(loop, conn, conn->parser.take(), keep_alive, nullptr);
+        }
+    }
+
+    // Hand req to a worker
+    void start(Loop& loop, const std::shared_ptr<Connection>& conn, std::shared_ptr<httplib::Request> req,
+               bool keep_alive, std::shared_ptr<BodyStream> stream) {
+        req->remote_addr = conn->remote_addr;
+        req->remote_port = conn->remote_port;
+        conn->busy = true;
+        conn->stream = stream;
+        {
+            std::lock_guard<std::mutex> lock(_in_flight_mutex);
+            ++_in_flight;
+        }
+        if (!_pool->enqueue([this, conn, req, keep_alive, stream] { handle(conn, req, keep_alive, stream); })) {
+            conn->busy = false; // Shutting down
+            close(loop, conn);
+            finished_one();
+        }
+    }
+
+    // Whether req's body goes to its handler as it arrives rather than buffered
+    bool streams_body(const httplib::Request& req) const {
+        for (const auto& route : _routes) {
+            if (route.method == req.method && std::regex_match(req.path, route.pattern)) {
+                return static_cast<bool>(route.reader_handler);
+            }
+        }
+        return false;
+    }
+
+    // Back from a worker: read on, or close if the response asked for it
+    void finish(Loop& loop, const Finished& finished) {
+        const auto& conn = finished.connection;
+        if (!conn->open) return;
+        conn->busy = false;
+        conn->last_active = std::chrono::steady_clock::now();
+        bool broken;
+        {
+            std::lock_guard<std::mutex> lock(conn->mutex);
+            broken = conn->broken;
+        }
+        if (broken) {
+            close(loop, conn);
+        } else if (finished.close || conn->close_after) {
+            close_when_sent(loop, conn);
+        } else {
+            on_readable(loop, conn);
+        }
+    }
+
+    // EPOLLOUT: send what workers (or the I/O thread) could not
+    void flush(Loop& loop, const std::shared_ptr<Connection>& conn) {
+        bool broken;
+        bool empty;
+        {
+            std::lock_guard<std::mutex> lock(conn->mutex);
+            size_t sent = 0;
+            while (!conn->broken && sent < conn->out.size()) {
+                ssize_t n = ::send(conn->fd, conn->out.data() + sent, conn->out.size() - sent, MSG_NOSIGNAL);
+                if (n >= 0) {
+                    sent += static_cast<size_t>(n);
+                } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    break;
+                } else if (errno != EINTR) {
+                    conn->broken = true;
+                }
+            }
+            conn->out.erase(0, sent);
+            if (sent > 0) conn->last_active = std::chrono::steady_clock::now();
+            broken = conn->broken;
+            empty = conn->out.empty();
+            if (broken || conn->out.size() <= _options.write_buffer_bytes) conn->drained.notify_all();
+        }
+        if (broken) {
+            close(loop, conn);
+        } else if (empty && conn->close_after && !conn->busy) {
+            close(loop, conn);
+        }
+    }
+
+    void close_when_sent(Loop& loop, const std::shared_ptr<Connection>& conn) {
+        conn->close_after = true;
+        bool empty;
+        {
+            std::lock_guard<std::mutex> lock(conn->mutex);
+            empty = conn->out.empty();
+        }
+        if (empty) close(loop, conn);
+    }
+
+    void close(Loop& loop, const std::shared_ptr<Connection>& conn) {
+        if (!conn->open) return;
+        conn->open = false;
+        if (conn->stream) {
+            conn->stream->fail();
+            conn->stream.reset();
+        }
+        {
+            std::lock_guard<std::mutex> lock(conn->mutex);
+            conn->broken = true;
+        }
+        conn->drained.notify_all();
+        epoll_ctl(loop.epoll_fd, EPOLL_CTL_DEL, conn->fd, nullptr);
+        ::close(conn->fd);
+        loop.connections.erase(conn->fd);
+    }
+
+    // Send now as far as the socket takes it and queue the rest for EPOLLOUT.
+    // Any thread; false once the connection is broken.
+    static bool send(Connection& conn, const std::string& data) {
+        std::lock_guard<std::mutex> lock(conn.mutex);
+        if (conn.broken) return false;
+        size_t sent = 0;
+        // Bytes already queued go first; the I/O thread sends them on EPOLLOUT
+        while (conn.out.empty() && sent < data.size()) {
+            ssize_t n = ::send(conn.fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+            if (n >= 0) {
+                sent += static_cast<size_t>(n);
+            } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            } else if (errno != EINTR) {
+                conn.broken = true;
+                conn.drained.notify_all();
+                return false;
+            }
+        }
+        conn.out.append(data, sent, std::string::npos);
+        return true;
+    }
+
+    void finished_one() {
+        std::lock_guard<std::mutex> lock(_in_flight_mutex);
+        if (--_in_flight == 0) _in_flight_done.notify_all();
+    }
+
+    // Worker: run the matching handler, then write its response and hand the
+    // connection back to its I/O thread. An asynchronous handler's response
+    // is written by whichever thread calls its done callback.
+    void handle(const std::shared_ptr<Connection>& conn, const std::shared_ptr<httplib::Request>& req,
+                bool keep_alive, const std::shared_ptr<BodyStream>& stream) {
+        auto res = std::make_shared<httplib::Response>();
+        auto answered = std::make_shared<std::atomic<bool>>(false);
+        auto respond = [this, conn, req, res, keep_alive, stream] {
+            // Unread body bytes would be taken for the next request
+            bool reusable = !stream || stream->release();
+            bool close = !respond_to(*conn, *req, *res, keep_alive && reusable);
+            {
+                std::lock_guard<std::mutex> lock(conn->loop->mutex);
+                conn->loop->finished.push_back(Finished{conn, close});
+            }
+            wake(*conn->loop);
+            finished_one();
+        };
+        Done done = [this, answered, res, respond] {
+            if (answered->exchange(true)) return;
+            // Streaming blocks on the client, so it goes back to a worker
+            // rather than holding up the thread that completed the request
+            if (res->content_provider_ && _pool->enqueue(respond)) return;
+            respond();
+        };
+
+        try {
+            if (!dispatch(*req, *res, done, stream)) {
+                res->status = 404; // Not Found
+                done();
+            }
+        } catch (const std::exception& e) {
+            log_event("EVENT SERVER: " + req->method + " " + req->path + " failed: " + e.what());
+            if (answered->exchange(true)) return; // The response is already on its way
+            res->status = 500; // Internal Server Error
+            res->body.clear();
+            res->content_provider_ = nullptr;
+            respond();
+        }
+    }
+
+    // Write the response. False if the connection must be closed afterwards.
+    bool respond_to(Connection& conn, const httplib::Request& req, httplib::Response& res, bool keep_alive) {
+        if (res.status == -1) res.status = 200;
+        keep_alive = keep_alive && res.get_header_value("Connection") != "close";
+
+        bool streamed = static_cast<bool>(res.content_provider_);
+        bool chunked = streamed && res.is_chunked_content_provider_ && req.version == "HTTP/1.1";
+        // A provider without a length (or chunks for an HTTP/1.0 client) ends with the connection
+        bool until_close = streamed && !chunked && (res.is_chunked_content_provider_ || res.content_length_ == 0);
+        if (until_close) keep_alive = false;
+
+        std::string head = "HTTP/1.1 " + std::to_string(res.status) + " " + httplib::status_message(res.status) + "\r\n";
+        for (const auto& header : res.headers) {
+            if (header.first == "Connection") continue;
+            head += header.first + ": " + header.second + "\r\n";
+        }
+        if (chunked) {
+            head += "Transfer-Encoding: chunked\r\n";
+        } else if (!until_close) {
+            head += "Content-Length: " + std::to_string(streamed ? res.content_length_ : res.body.size()) + "\r\n";
+        }
+        head += keep_alive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n";
+
+        if (!streamed) return send(conn, head + res.body) && keep_alive;
+        if (!send(conn, head)) return false;
+        res.content_provider_success_ = stream(conn, res, chunked);
+        // A body cut short can only be signalled by closing
+        return res.content_provider_success_ && keep_alive;
+    }
+
+    // Run the route matching req; done is called once the response is ready.
+    // stream carries the body of a ContentReader route. False if no route
+    // matches.
+    bool dispatch(httplib::Request& req, httplib::Response& res, const Done& done,
+                  const std::shared_ptr<BodyStream>& stream) {
+        for (const auto& route : _routes) {
+            if (route.method != req.method || !std::regex_match(req.path, req.matches, route.pattern)) continue;
+            if (route.async_handler) {
+                route.async_handler(req, res, done);
+                return true;
+            }
+            if (route.handler) {
+                route.handler(req, res);
+                done();
+                return true;
+            }
+            std::string body = std::move(req.body);
+            req.body.clear();
+            httplib::ContentReader reader(
+                [&body, &stream](httplib::ContentReceiver receiver) {
+                    if (stream) return stream->read(receiver);
+                    return body.empty() || receiver(body.data(), body.size());
+                },
+                [](httplib::FormDataHeader, httplib::ContentReceiver) { return false; }); // No multipart uploads
+            route.reader_handler(req, res, reader);
+            done();
+            return true;
+        }
+        return false;
+    }
+
+    // Pull the body from the content provider, pausing while the client lags
+    bool stream(Connection& conn, httplib::Response& res, bool chunked) {
+        bool ok = true;
+        bool done = false;
+        size_t offset = 0;
+        httplib::DataSink sink;
+        sink.write = [&](const char* data, size_t len) {
+            if (!ok) return false;
+            if (len == 0) return true; // An empty chunk would end the body
+            offset += len;
+            std::string frame = chunked ? to_hex(len) + "\r\n" + std::string(data, len) + "\r\n" : std::string(data, len);
+            ok = send(conn, frame) && wait_drained(conn);
+            return ok;
+        };
+        sink.is_writable = [&] {
+            std::lock_guard<std::mutex> lock(conn.mutex);
+            return !conn.broken;
+        };
+        sink.done = [&] { done = true; };
+        sink.done_with_trailer = [&](const httplib::Headers&) { done = true; }; // Trailers are not sent
+
+        bool fixed_length = !res.is_chunked_content_provider_ && res.content_length_ > 0;
+        while (ok && !done && !(fixed_length && offset >= res.content_length_)) {
+            size_t length = fixed_length ? res.content_length_ - offset : 0;
+            if (!res.content_provider_(offset, length, sink)) ok = false;
+        }
+        if (ok && chunked) ok = send(conn, "0\r\n\r\n");
+        return ok;
+    }
+
+    bool wait_drained(Connection& conn) {
+        std::unique_lock<std::mutex> lock(conn.mutex);
+        conn.drained.wait(lock, [&] { return conn.broken || conn.out.size() <= _options.write_buffer_bytes; });
+        return !conn.broken;
+    }
+
+    static std::string to_hex(size_t n) {
+        static const char digits[] = "0123456789abcdef";
+        std::string hex;
+        do {
+            hex.insert(hex.begin(), digits[n % 16]);
+            n /= 16;
+        } while (n > 0);
+        return hex;
+    }
+};
@@ -0,0 +1,171 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include "json.hpp"
+
+// Incremental parser for bulk-import bodies, fed the request body chunk by
+// chunk as it arrives, so an import never has to hold the whole body.
+//
+// NDJSON: one {"key": "...", "value": "..."} object per line; blank lines
+// are skipped. CSV (RFC 4180): two fields per record, key then value;
+// fields may be quoted ("a ""quoted"", multi-line value"), and a header
+// record can be skipped. Malformed input throws std::invalid_argument
+// naming the line it started on.
+class ImportReader {
+public:
+    enum class Format { NDJSON, CSV };
+    using RowFn = std::function<void(std::string key, std::string value)>;
+
+    ImportReader(Format format, RowFn on_row, bool skip_header = false)
+        : _format(format), _on_row(std::move(on_row)), _skip_header(skip_header) {}
+
+    void feed(const char* data, size_t len) {
+        if (_format == Format::NDJSON) {
+            feed_ndjson(data, len);
+        } else {
+            for (size_t i = 0; i < len; ++i) feed_csv(data[i]);
+        }
+    }
+
+    // End of body: emit a final record without a trailing newline
+    void finish() {
+        if (_format == Format::NDJSON) {
+            if (!_partial.empty()) ndjson_line();
+            return;
+        }
+        if (_state == CsvState::Quoted) fail("unterminated quoted field");
+        if (_state != CsvState::RecordStart) end_csv_record();
+    }
+
+    size_t rows() const { return _rows; }
+
+private:
+    enum class CsvState { RecordStart, FieldStart, Unquoted, Quoted, QuoteInQuoted };
+
+    Format _format;
+    RowFn _on_row;
+    bool _skip_header;
+    size_t _rows = 0;
+    size_t _line = 1; // Current input line (1-based)
+    size_t _record_line = 1; // Line the current record started on
+
+    // NDJSON: the partial line carried over between chunks
+    std::string _partial;
+
+    // CSV state machine
+    CsvState _state = CsvState::RecordStart;
+    std::string _field;
+    std::vector<std::string> _fields;
+
+    [[noreturn]] void fail(const std::string& what) const {
+        throw std::invalid_argument("line " + std::to_string(_record_line) + ": " + what);
+    }
+
+    void emit(std::string key, std::string value) {
+        if (_skip_header) {
+            _skip_header = false;
+            return;
+        }
+        ++_rows;
+        _on_row(std::move(key), std::move(value));
+    }
+
+    void feed_ndjson(const char* data, size_t len) {
+        size_t start = 0;
+        for (size_t i = 0; i < len; ++i) {
+            if (data[i] != '\n') continue;
+            _partial.append(data + start, i - start);
+            ndjson_line();
+            start = i + 1;
+        }
+        _partial.append(data + start, len - start);
+    }
+
+    void ndjson_line() {
+        _record_line = _line++;
+        std::string line = std::move(_partial);
+        _partial.clear();
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (line.find_first_not_of(" \t") == std::string::npos) return;
+
+        auto j = nlohmann::json::parse(line, nullptr, false);
+        if (j.is_discarded() || !j.is_object()) fail("not a JSON object");
+        auto key = j.find("key");
+        auto value = j.find("value");
+        if (key == j.end() || !key->is_string() || value == j.end() || !value->is_string()) {
+            fail("expected string \"key\" and \"value\"");
+        }
+        emit(key->get<std::string>(), value->get<std::string>());
+    }
+
+    void feed_csv(char c) {
+        switch (_state) {
+            case CsvState::RecordStart:
+                _record_line = _line;
+                if (c == '\n') {
+                    ++_line; // Blank line
+                    return;
+                }
+                if (c == '\r') return;
+                _state = CsvState::FieldStart;
+                [[fallthrough]];
+            case CsvState::FieldStart:
+                if (c == '"') {
+                    _state = CsvState::Quoted;
+                    return;
+                }
+                _state = CsvState::Unquoted;
+                [[fallthrough]];
+            case CsvState::Unquoted:
+                if (c == ',') {
+                    end_csv_field();
+                } else if (c == '\n') {
+                    ++_line;
+                    end_csv_record();
+                } else if (c != '\r') {
+                    _field += c;
+                }
+                return;
+            case CsvState::Quoted:
+                if (c == '"') {
+                    _state = CsvState::QuoteInQuoted;
+                } else {
+                    if (c == '\n') ++_line;
+                    _field += c;
+                }
+                return;
+            case CsvState::QuoteInQuoted:
+                if (c == '"') { // Escaped quote
+                    _field += '"';
+                    _state = CsvState::Quoted;
+                } else if (c == ',') {
+                    end_csv_field();
+                } else if (c == '\n') {
+                    ++_line;
+                    end_csv_record();
+                } else if (c != '\r') {
+                    fail("unexpected character after closing quote");
+                }
+                return;
+        }
+    }
+
+    void end_csv_field() {
+        _fields.push_back(std::move(_field));
+        _field.clear();
+        _state = CsvState::FieldStart;
+    }
+
+    void end_csv_record() {
+        end_csv_field();
+        if (_fields.size() != 2) fail("expected 2 fields, got " + std::to_string(_fields.size()));
+        emit(std::move(_fields[0]), std::move(_fields[1]));
+        _fields.clear();
+        _state = CsvState::RecordStart;
+    }
+};
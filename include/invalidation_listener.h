@@ -0,0 +1,221 @@
+#pragma once
+
+#include <libpq-fe.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include "json.hpp"
+#include "logger.h"
+
+// Receives the cache invalidations other server instances publish with
+// pg_notify() (see PostgresBackend::Options::notify_channel) on a dedicated
+// libpq connection that LISTENs on the channel.
+//
+// Payloads are JSON: {"origin": <instance id>, "keys": [...], "hex": [...]}
+// (keys that are not valid UTF-8 come hex-encoded in "hex"; either array may
+// be missing) or {"origin": <instance id>, "all": true}. This instance's own notifications
+// are ignored, since its cache is already up to date. Notifications arriving
+// within batch_window of the first one are collected and delivered as one
+// deduplicated on_keys call. If the connection drops, notifications sent in
+// the meantime are lost, so after reconnecting (and after an "all" payload)
+// on_reset is called instead, which should drop every cached entry.
+class InvalidationListener {
+public:
+    using KeysFn = std::function<void(const std::vector<std::string>& keys)>;
+    using ResetFn = std::function<void()>;
+
+    InvalidationListener(const std::string& conninfo, const std::string& channel, const std::string& instance_id,
+                         std::chrono::milliseconds batch_window, KeysFn on_keys, ResetFn on_reset,
+                         std::chrono::milliseconds reconnect_delay = std::chrono::milliseconds(1000))
+        : _conninfo(conninfo), _channel(channel), _instance_id(instance_id), _batch_window(batch_window),
+          _reconnect_delay(reconnect_delay), _on_keys(std::move(on_keys)), _on_reset(std::move(on_reset)) {
+        _wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    }
+
+    ~InvalidationListener() {
+        _stopping = true;
+        uint64_t one = 1;
+        (void)!write(_wake_fd, &one, sizeof(one));
+        if (_thread.joinable()) _thread.join();
+        close(_wake_fd);
+    }
+
+    InvalidationListener(const InvalidationListener&) = delete;
+    InvalidationListener& operator=(const InvalidationListener&) = delete;
+
+    void start() {
+        _thread = std::thread([this] { run(); });
+    }
+
+private:
+    std::string _conninfo;
+    std::string _channel;
+    std::string _instance_id;
+    std::chrono::milliseconds _batch_window;
+    std::chrono::milliseconds _reconnect_delay;
+    KeysFn _on_keys;
+    ResetFn _on_reset;
+    int _wake_fd;
+    std::atomic<bool> _stopping{false};
+    std::thread _thread;
+
+    // Pending work gathered from notifications, delivered once per batch
+    std::unordered_set<std::string> _keys;
+    bool _reset = false;
+
+    void run() {
+        bool connected_before = false;
+        while (!_stopping) {
+            PGconn* conn = connect();
+            if (!conn) {
+                wait_for(-1, _wake_fd, _reconnect_delay);
+                continue;
+            }
+            log_event("INVALIDATION: Listening on channel '" + _channel + "'");
+            // Anything published while disconnected was missed
+            if (connected_before) {
+                log_event("INVALIDATION: Reconnected, dropping the whole cache");
+                _on_reset();
+            }
+            connected_before = true;
+
+            listen(conn);
+            PQfinish(conn);
+        }
+    }
+
+    PGconn* connect() {
+        PGconn* conn = PQconnectdb(_conninfo.c_str());
+        if (PQstatus(conn) != CONNECTION_OK) {
+            log_event(std::string("INVALIDATION: Connection failed: ") + PQerrorMessage(conn));
+            PQfinish(conn);
+            return nullptr;
+        }
+        char* channel = PQescapeIdentifier(conn, _channel.c_str(), _channel.size());
+        PGresult* res = PQexec(conn, (std::string("LISTEN ") + (channel ? channel : "")).c_str());
+        PQfreemem(channel);
+        bool ok = PQresultStatus(res) == PGRES_COMMAND_OK;
+        PQclear(res);
+        if (!ok) {
+            log_event(std::string("INVALIDATION: LISTEN failed: ") + PQerrorMessage(conn));
+            PQfinish(conn);
+            return nullptr;
+        }
+        return conn;
+    }
+
+    // Read notifications until the connection breaks or the listener stops
+    void listen(PGconn* conn) {
+        int sock = PQsocket(conn);
+        std::chrono::steady_clock::time_point batch_deadline;
+        bool batching = false;
+
+        while (!_stopping) {
+            auto timeout = std::chrono::milliseconds(-1);
+            if (batching) {
+                timeout = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    batch_deadline - std::chrono::steady_clock::now());
+                if (timeout.count() < 0) timeout = std::chrono::milliseconds(0);
+            }
+            if (wait_for(sock, _wake_fd, timeout)) {
+                if (!PQconsumeInput(conn)) {
+                    log_event(std::string("INVALIDATION: Connection lost: ") + PQerrorMessage(conn));
+                    deliver();
+                    return;
+                }
+                bool received = false;
+                while (PGnotify* notify = PQnotifies(conn)) {
+                    received |= parse(notify->extra);
+                    PQfreemem(notify);
+                }
+                if (received && !batching) {
+                    batching = true;
+                    batch_deadline = std::chrono::steady_clock::now() + _batch_window;
+                }
+            }
+            if (batching && std::chrono::steady_clock::now() >= batch_deadline) {
+                deliver();
+                batching = false;
+            }
+        }
+    }
+
+    // Record one payload; false if it is ours or unreadable
+    bool parse(const char* payload) {
+        auto j = nlohmann::json::parse(payload, nullptr, false);
+        if (j.is_discarded() || !j.is_object()) {
+            log_event(std::string("INVALIDATION: Ignoring malformed payload: ") + payload);
+            return false;
+        }
+        if (j.value("origin", "") == _instance_id) return false;
+        if (j.value("all", false)) {
+            _reset = true;
+            return true;
+        }
+        auto keys = j.find("keys");
+        auto hex_keys = j.find("hex");
+        bool has_keys = keys != j.end() && keys->is_array();
+        bool has_hex = hex_keys != j.end() && hex_keys->is_array();
+        if (!has_keys && !has_hex) return false;
+        if (has_keys) {
+            for (const auto& key : *keys) {
+                if (key.is_string()) _keys.insert(key.get<std::string>());
+            }
+        }
+        if (has_hex) {
+            for (const auto& key : *hex_keys) {
+                std::string bytes;
+                if (key.is_string() && from_hex(key.get<std::string>(), bytes)) _keys.insert(std::move(bytes));
+            }
+        }
+        return true;
+    }
+
+    static bool from_hex(const std::string& hex, std::string& bytes) {
+        if (hex.size() % 2 != 0) return false;
+        auto digit = [](char c) {
+            if (c >= '0' && c <= '9') return c - '0';
+            if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+            if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+            return -1;
+        };
+        bytes.clear();
+        bytes.reserve(hex.size() / 2);
+        for (size_t i = 0; i < hex.size(); i += 2) {
+            int high = digit(hex[i]);
+            int low = digit(hex[i + 1]);
+            if (high < 0 || low < 0) return false;
+            bytes += static_cast<char>(high * 16 + low);
+        }
+        return true;
+    }
+
+    void deliver() {
+        if (_reset) {
+            log_event("INVALIDATION: Another instance asked for a full cache reset");
+            _on_reset();
+        } else if (!_keys.empty()) {
+            log_event("INVALIDATION: Dropping " + std::to_string(_keys.size()) + " key(s) changed by other instances");
+            _on_keys(std::vector<std::string>(_keys.begin(), _keys.end()));
+        }
+        _keys.clear();
+        _reset = false;
+    }
+
+    // Wait until fd is readable (true), or wake_fd fires or timeout passes
+    // (false). A negative fd is skipped; a negative timeout waits forever.
+    static bool wait_for(int fd, int wake_fd, std::chrono::milliseconds timeout) {
+        pollfd fds[2] = {{fd, POLLIN, 0}, {wake_fd, POLLIN, 0}};
+        int ready = poll(fds, 2, static_cast<int>(timeout.count()));
+        return ready > 0 && fd >= 0 && (fds[0].revents & (POLLIN | POLLERR | POLLHUP));
+    }
+};
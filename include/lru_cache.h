@@ -1,18 +1,71 @@
 #pragma once
 
+#include <chrono>
+#include <cstdint>
 #include <iostream>
 #include <string>
 #include <list>
 #include <unordered_map>
 #include <mutex>
 #include <optional>
+#include <iterator>
+#include <array>
+#include <functional>
+
+enum class EvictionPolicy {
+    LRU,  // Single recency list
+    SLRU  // Segmented LRU: probationary + protected segments (scan resistant)
+};
+
+// How long a cached value may be served, measured from when it was stored.
+// An entry is fresh for ttl, then stale (served, but due for a background
+// refresh) for stale_while_revalidate more. After that it is expired: kept
+// for stale_if_error longer only as a fallback when the backend cannot be
+// reached, then dropped. A zero ttl means entries never expire.
+//
+// Refresh-ahead: once an entry is in the last refresh_ahead fraction of its
+// fresh period and has been hit at least refresh_ahead_min_hits times since
+// it was stored, lookups flag it for a background reload, so hot keys are
+// renewed before they ever go stale. 0 disables it.
+struct CacheExpiry {
+    std::chrono::milliseconds ttl{0};
+    std::chrono::milliseconds stale_while_revalidate{0};
+    std::chrono::milliseconds stale_if_error{0};
+    double refresh_ahead = 0;
+    uint32_t refresh_ahead_min_hits = 1;
+};
+
+enum class Freshness { Fresh, Stale, Expired };
 
 class LRUCache {
 public:
-    LRUCache(size_t capacity) : _capacity(capacity) {}
+    using Clock = std::chrono::steady_clock;
+
+    // A cached value with its age class. version identifies this stored
+    // value, so a background refresh can tell whether it was overwritten.
+    struct Lookup {
+        std::string value;
+        Freshness freshness;
+        uint64_t version;
+        bool refresh_due; // Fresh, but hot and close enough to expiry to reload ahead
+    };
+
+    // In SLRU mode, protected_ratio is the share of the capacity reserved for
+    // entries that were hit at least once after insertion.
+    LRUCache(size_t capacity, EvictionPolicy policy = EvictionPolicy::LRU, double protected_ratio = 0.8,
+             const CacheExpiry& expiry = {})
+        : _capacity(capacity), _policy(policy), _protected_ratio(protected_ratio), _expiry(expiry) {}
 
-    // Get a value from the cache
+    // Get a fresh or stale value from the cache
     std::optional<std::string> get(const std::string& key) {
+        auto found = lookup(key);
+        if (!found || found->freshness == Freshness::Expired) return std::nullopt;
+        return std::move(found->value);
+    }
+
+    // Get a value in any age class, counting as an access. Entries past
+    // their stale_if_error allowance are dropped and reported as a miss.
+    std::optional<Lookup> lookup(const std::string& key) {
         std::lock_guard<std::mutex> lock(_mutex);
 
         // Check if key exists in the map
@@ -21,53 +74,248 @@ public:
             return std::nullopt; // Cache miss
         }
 
-        // Key found: Move it to the front of the list (most recently used)
-        _list.splice(_list.begin(), _list, it->second.second);
-        
+        Entry& entry = it->second;
+        auto now = Clock::now();
+        Freshness freshness = now < entry.fresh_until ? Freshness::Fresh
+                              : now < entry.stale_until ? Freshness::Stale
+                              : Freshness::Expired;
+        if (freshness == Freshness::Expired && now - entry.stale_until >= _expiry.stale_if_error) {
+            erase_locked(it);
+            return std::nullopt;
+        }
+        ++entry.hits;
+        bool refresh_due = freshness == Freshness::Fresh && now >= entry.refresh_at &&
+                           entry.hits >= _expiry.refresh_ahead_min_hits;
+
+        if (_policy == EvictionPolicy::SLRU && !entry.is_protected) {
+            // Second hit: promote from probation to the front of the protected segment
+            _protected.splice(_protected.begin(), _list, entry.it);
+            entry.is_protected = true;
+            enforce_protected_limit(1);
+        } else {
+            // Key found: Move it to the front of its list (most recently used)
+            std::list<std::string>& segment = entry.is_protected ? _protected : _list;
+            segment.splice(segment.begin(), segment, entry.it);
+        }
+
         // Return the value
-        return it->second.first;
+        return Lookup{entry.value, freshness, entry.version, refresh_due};
     }
 
-    // Put a key-value pair into the cache
-    void put(const std::string& key, const std::string& value) {
+    // Whether the key is cached, still fresh, with exactly this value, and
+    // that value was put as durable; does not count as an access
+    bool matches_durable(const std::string& key, const std::string& value) {
         std::lock_guard<std::mutex> lock(_mutex);
+        auto it = _map.find(key);
+        return it != _map.end() && it->second.durable && Clock::now() < it->second.fresh_until &&
+               it->second.value == value;
+    }
 
-        // Check if key already exists
+    // Apply a background refresh of the value read as version: store value
+    // (restarting its TTL) or, for std::nullopt, drop the entry. Does nothing
+    // if the entry was written, removed or evicted since, so a slow refresh
+    // never overwrites a newer value. Not an access.
+    bool revalidate(const std::string& key, uint64_t version, const std::optional<std::string>& value) {
+        std::lock_guard<std::mutex> lock(_mutex);
         auto it = _map.find(key);
-        if (it != _map.end()) {
-            // Key exists: update value and move to front
-            it->second.first = value;
-            _list.splice(_list.begin(), _list, it->second.second);
-            return;
+        if (it == _map.end() || it->second.version != version) return false;
+        if (!value) {
+            erase_locked(it);
+            return true;
         }
+        it->second.durable = it->second.durable && it->second.value == *value;
+        it->second.value = *value;
+        stamp(it->second);
+        return true;
+    }
 
-        // Key doesn't exist: check for capacity
-        if (_list.size() >= _capacity) {
-            // Cache is full: evict the least recently used item (from the back)
-            std::string lru_key = _list.back();
-            _list.pop_back();
-            _map.erase(lru_key);
-        }
+    // Put a key-value pair into the cache. durable: the value is known to be
+    // in stable storage (a synchronous write). Re-putting a durable value
+    // keeps it durable.
+    void put(const std::string& key, const std::string& value, bool durable = false) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        ++_write_seq[bucket(key)];
+        put_locked(key, value, durable);
+    }
 
-        // Add the new key-value pair to the front
-        _list.push_front(key);
-        _map[key] = {value, _list.begin()};
+    // Token to take before reading a missing key from the backend; pass it
+    // to fill() with the value read
+    uint64_t fill_token(const std::string& key) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _write_seq[bucket(key)];
+    }
+
+    // Cache a value read from the backend, unless the key may have been
+    // written, removed or invalidated since fill_token() (same hash bucket),
+    // in which case the read may predate that change and is not cached
+    bool fill(const std::string& key, const std::string& value, uint64_t token) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_write_seq[bucket(key)] != token) return false;
+        put_locked(key, value, false);
+        return true;
+    }
+
+    // Drop every entry (e.g. after missing invalidations); capacity is unchanged
+    void clear() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (auto& seq : _write_seq) ++seq;
+        _map.clear();
+        _list.clear();
+        _protected.clear();
     }
 
     // Remove a key from the cache (for DELETE operations)
     void remove(const std::string& key) {
         std::lock_guard<std::mutex> lock(_mutex);
+        ++_write_seq[bucket(key)];
 
         auto it = _map.find(key);
-        if (it != _map.end()) {
-            _list.erase(it->second.second);
-            _map.erase(it);
+        if (it != _map.end()) erase_locked(it);
+    }
+
+    // Change the capacity at runtime. Growing takes effect immediately; when
+    // shrinking, excess entries are left in place and evicted incrementally
+    // by trim() so a large shrink never holds the lock for long.
+    void set_capacity(size_t capacity) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _capacity = capacity;
+    }
+
+    // Evict at most max_evictions LRU entries while the cache is over
+    // capacity. Returns how many entries are still over capacity (in SLRU
+    // mode, plus protected entries still waiting to be demoted).
+    size_t trim(size_t max_evictions) {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        while (max_evictions > 0 && size_locked() > _capacity) {
+            evict_one();
+            --max_evictions;
         }
+        size_t remaining = size_locked() > _capacity ? size_locked() - _capacity : 0;
+        if (_policy == EvictionPolicy::SLRU) {
+            enforce_protected_limit(max_evictions);
+            size_t limit = protected_limit();
+            remaining += _protected.size() > limit ? _protected.size() - limit : 0;
+        }
+        return remaining;
+    }
+
+    size_t capacity() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _capacity;
+    }
+
+    size_t size() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return size_locked();
+    }
+
+    // Entries in the protected segment (always 0 in LRU mode)
+    size_t protected_size() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _protected.size();
     }
 
+    EvictionPolicy policy() const { return _policy; }
+
 private:
+    struct Entry {
+        std::string value;
+        std::list<std::string>::iterator it; // Position in _list or _protected
+        bool is_protected;
+        Clock::time_point fresh_until;
+        Clock::time_point stale_until;
+        Clock::time_point refresh_at; // Start of the refresh-ahead window
+        uint32_t hits; // Lookups since the value was stored
+        uint64_t version; // Changes on every put or revalidate
+        bool durable; // Value known to be in stable storage, not just read or written asynchronously
+    };
+
     size_t _capacity;
-    std::list<std::string> _list; // Stores keys, front is MRU, back is LRU
-    std::unordered_map<std::string, std::pair<std::string, std::list<std::string>::iterator>> _map; // key -> {value, list_iterator}
+    EvictionPolicy _policy;
+    double _protected_ratio;
+    CacheExpiry _expiry;
+    uint64_t _next_version = 0;
+    std::array<uint64_t, 1024> _write_seq{}; // Per key-hash bucket: bumped by every put, remove and clear
+    std::list<std::string> _list; // Stores keys, front is MRU, back is LRU (probationary segment in SLRU mode)
+    std::list<std::string> _protected; // SLRU only: keys hit again while on probation
+    std::unordered_map<std::string, Entry> _map; // key -> {value, list_iterator, segment}
     std::mutex _mutex;
-};
\ No newline at end of file
+
+    size_t size_locked() const { return _list.size() + _protected.size(); }
+
+    size_t bucket(const std::string& key) const { return std::hash<std::string>{}(key) % _write_seq.size(); }
+
+    void put_locked(const std::string& key, const std::string& value, bool durable) {
+        // Check if key already exists
+        auto it = _map.find(key);
+        if (it != _map.end()) {
+            // Key exists: update value and move to front of its segment
+            Entry& entry = it->second;
+            entry.durable = durable || (entry.durable && entry.value == value);
+            entry.value = value;
+            stamp(entry);
+            std::list<std::string>& segment = entry.is_protected ? _protected : _list;
+            segment.splice(segment.begin(), segment, entry.it);
+            return;
+        }
+
+        // Key doesn't exist: check for capacity
+        if (size_locked() >= _capacity) {
+            // Cache is full: evict the least recently used item (from the back)
+            evict_one();
+        }
+
+        // Add the new key-value pair to the front (probationary segment in SLRU mode)
+        _list.push_front(key);
+        Entry& entry = _map[key];
+        entry.value = value;
+        entry.it = _list.begin();
+        entry.is_protected = false;
+        entry.durable = durable;
+        stamp(entry);
+    }
+
+    // Restart the entry's TTL and give it a new version
+    void stamp(Entry& entry) {
+        entry.version = ++_next_version;
+        entry.hits = 0;
+        if (_expiry.ttl.count() <= 0) {
+            entry.fresh_until = entry.stale_until = entry.refresh_at = Clock::time_point::max();
+            return;
+        }
+        entry.fresh_until = Clock::now() + _expiry.ttl;
+        entry.stale_until = entry.fresh_until + _expiry.stale_while_revalidate;
+        entry.refresh_at = _expiry.refresh_ahead > 0
+            ? entry.fresh_until - std::chrono::duration_cast<Clock::duration>(_expiry.ttl * _expiry.refresh_ahead)
+            : Clock::time_point::max();
+    }
+
+    void erase_locked(std::unordered_map<std::string, Entry>::iterator it) {
+        (it->second.is_protected ? _protected : _list).erase(it->second.it);
+        _map.erase(it);
+    }
+
+    size_t protected_limit() const { return static_cast<size_t>(_capacity * _protected_ratio); }
+
+    // Victims come from the probationary segment first, so a scan that touches
+    // every key once only churns probation and leaves the protected set intact
+    void evict_one() {
+        std::list<std::string>& segment = _list.empty() ? _protected : _list;
+        if (segment.empty()) return;
+        _map.erase(segment.back());
+        segment.pop_back();
+    }
+
+    // Demote protected LRU entries back to probation (as MRU there) while the
+    // protected segment exceeds its share of the capacity
+    void enforce_protected_limit(size_t max_moves) {
+        size_t limit = protected_limit();
+        while (max_moves > 0 && _protected.size() > limit) {
+            auto last = std::prev(_protected.end());
+            _map.find(*last)->second.is_protected = false;
+            _list.splice(_list.begin(), _protected, last);
+            --max_moves;
+        }
+    }
+};
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <sys/stat.h>
+
+// Snapshot of the memory state of the cgroup this process runs in.
+struct MemorySample {
+    uint64_t current = 0;          // Bytes charged to the cgroup
+    std::optional<uint64_t> limit; // Hard limit in bytes (empty if unlimited)
+    std::optional<double> psi_some_avg10; // % of time some task stalled on memory (last 10s)
+
+    // Fraction of the limit in use, or 0 when there is no limit
+    double usage_ratio() const {
+        return limit && *limit > 0 ? static_cast<double>(current) / static_cast<double>(*limit) : 0.0;
+    }
+};
+
+// Reads cgroup memory usage, limit and pressure (PSI). Supports cgroup v2
+// (memory.current / memory.max / memory.pressure) and falls back to the
+// cgroup v1 memory controller (memory.usage_in_bytes / memory.limit_in_bytes).
+class MemoryMonitor {
+public:
+    MemoryMonitor(const std::string& cgroup_root = "/sys/fs/cgroup") {
+        std::string own = own_cgroup_v2_path();
+        if (!own.empty() && is_file(cgroup_root + own + "/memory.current")) {
+            _dir = cgroup_root + own;
+            _v2 = true;
+        } else if (is_file(cgroup_root + "/memory.current")) {
+            _dir = cgroup_root;
+            _v2 = true;
+        } else if (is_file(cgroup_root + "/memory/memory.usage_in_bytes")) {
+            _dir = cgroup_root + "/memory";
+            _v2 = false;
+        }
+    }
+
+    // False when no memory controller could be found (e.g. not in a cgroup)
+    bool available() const { return !_dir.empty(); }
+
+    const std::string& path() const { return _dir; }
+
+    std::optional<MemorySample> sample() const {
+        if (!available()) return std::nullopt;
+
+        MemorySample s;
+        auto current = read_first_token(_dir + (_v2 ? "/memory.current" : "/memory.usage_in_bytes"));
+        if (!current) return std::nullopt;
+        try {
+            s.current = std::stoull(*current);
+        } catch (...) {
+            return std::nullopt;
+        }
+
+        auto limit = read_first_token(_dir + (_v2 ? "/memory.max" : "/memory.limit_in_bytes"));
+        if (limit && *limit != "max") {
+            try {
+                uint64_t value = std::stoull(*limit);
+                // cgroup v1 reports "unlimited" as a huge page-aligned number
+                if (value < (UINT64_C(1) << 62)) s.limit = value;
+            } catch (...) {}
+        }
+
+        if (_v2) s.psi_some_avg10 = read_psi_some_avg10(_dir + "/memory.pressure");
+        return s;
+    }
+
+private:
+    std::string _dir;
+    bool _v2 = false;
+
+    static bool is_file(const std::string& path) {
+        struct stat st;
+        return stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode);
+    }
+
+    static std::optional<std::string> read_first_token(const std::string& path) {
+        std::ifstream in(path);
+        std::string token;
+        if (!(in >> token)) return std::nullopt;
+        return token;
+    }
+
+    // The unified hierarchy entry in /proc/self/cgroup looks like "0::/path"
+    static std::string own_cgroup_v2_path() {
+        std::ifstream in("/proc/self/cgroup");
+        std::string line;
+        while (std::getline(in, line)) {
+            if (line.rfind("0::", 0) == 0) {
+                std::string path = line.substr(3);
+                return path == "/" ? "" : path;
+            }
+        }
+        return "";
+    }
+
+    // Parses "some avg10=1.23 avg60=... avg300=... total=..."
+    static std::optional<double> read_psi_some_avg10(const std::string& path) {
+        std::ifstream in(path);
+        std::string line;
+        while (std::getline(in, line)) {
+            if (line.rfind("some ", 0) != 0) continue;
+            std::istringstream fields(line.substr(5));
+            std::string field;
+            while (fields >> field) {
+                if (field.rfind("avg10=", 0) == 0) {
+                    try {
+                        return std::stod(field.substr(6));
+                    } catch (...) {
+                        return std::nullopt;
+                    }
+                }
+            }
+        }
+        return std::nullopt;
+    }
+};
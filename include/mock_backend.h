@@ -0,0 +1,278 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <queue>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "logger.h"
+#include "storage_backend.h"
+
+// Latency injected per backend operation, parsed from a spec such as
+//   "none", "fixed:2", "uniform:1:5", "lognormal:2:0.5"
+// (milliseconds; lognormal takes the median and sigma), optionally followed by
+// ",spike:<probability>:<ms>" to add rare tail spikes on top.
+struct LatencyModel {
+    enum class Kind { None, Fixed, Uniform, LogNormal };
+
+    Kind kind = Kind::None;
+    double a = 0; // fixed / uniform min / lognormal median
+    double b = 0; // uniform max / lognormal sigma
+    double spike_probability = 0;
+    double spike_ms = 0;
+
+    // Throws std::invalid_argument on a malformed spec
+    static LatencyModel parse(const std::string& spec) {
+        LatencyModel model;
+        std::string base = spec;
+        size_t comma = spec.find(',');
+        if (comma != std::string::npos) {
+            base = spec.substr(0, comma);
+            auto spike = split(spec.substr(comma + 1));
+            if (spike.size() != 3 || spike[0] != "spike") throw std::invalid_argument("Bad latency spike: " + spec);
+            model.spike_probability = number(spike[1], spec);
+            model.spike_ms = number(spike[2], spec);
+        }
+
+        auto parts = split(base);
+        if (parts[0] == "none" && parts.size() == 1) {
+            model.kind = Kind::None;
+        } else if (parts[0] == "fixed" && parts.size() == 2) {
+            model.kind = Kind::Fixed;
+            model.a = number(parts[1], spec);
+        } else if (parts[0] == "uniform" && parts.size() == 3) {
+            model.kind = Kind::Uniform;
+            model.a = number(parts[1], spec);
+            model.b = number(parts[2], spec);
+        } else if (parts[0] == "lognormal" && parts.size() == 3) {
+            model.kind = Kind::LogNormal;
+            model.a = number(parts[1], spec);
+            model.b = number(parts[2], spec);
+        } else {
+            throw std::invalid_argument("Bad latency spec: " + spec);
+        }
+        if ((model.kind == Kind::Uniform && model.a > model.b) || (model.kind == Kind::LogNormal && model.a <= 0) ||
+            model.spike_probability > 1) {
+            throw std::invalid_argument("Bad latency spec: " + spec);
+        }
+        return model;
+    }
+
+    std::chrono::microseconds sample(std::mt19937_64& rng) const {
+        double ms = 0;
+        switch (kind) {
+            case Kind::None: break;
+            case Kind::Fixed: ms = a; break;
+            case Kind::Uniform: ms = std::uniform_real_distribution<double>(a, b)(rng); break;
+            case Kind::LogNormal: ms = std::lognormal_distribution<double>(std::log(a), b)(rng); break;
+        }
+        if (spike_probability > 0 && std::bernoulli_distribution(spike_probability)(rng)) ms += spike_ms;
+        return std::chrono::microseconds(static_cast<int64_t>(ms * 1000));
+    }
+
+private:
+    static std::vector<std::string> split(const std::string& s) {
+        std::vector<std::string> parts;
+        std::stringstream in(s);
+        std::string part;
+        while (std::getline(in, part, ':')) parts.push_back(part);
+        if (parts.empty()) parts.push_back("");
+        return parts;
+    }
+
+    static double number(const std::string& s, const std::string& spec) {
+        try {
+            size_t used = 0;
+            double value = std::stod(s, &used);
+            if (used == s.size() && value >= 0) return value;
+        } catch (const std::exception&) {
+        }
+        throw std::invalid_argument("Bad number in latency spec: " + spec);
+    }
+};
+
+// In-memory StorageBackend for benchmarking the HTTP and cache layers without
+// a database. Data lives in hash-sharded ordered maps (one mutex per shard)
+// and is lost on exit. Every call is delayed by a sample from the read, write
+// or scan latency model. Blocking calls sleep on the caller's thread, while
+// multi_get_async completes from a timer thread, the way a non-blocking
+// database client would. Latencies come from one generator per backend,
+// seeded only from seed and drawn from under a mutex, so two backends with
+// the same seed produce the same sequence of samples.
+class MockBackend : public StorageBackend {
+public:
+    struct Options {
+        size_t shards = 64;
+        LatencyModel read_latency;
+        LatencyModel write_latency;
+        LatencyModel scan_latency;
+        uint64_t seed = 42;
+    };
+
+    explicit MockBackend(const Options& options)
+        : _options(options), _shards(std::max<size_t>(1, options.shards)), _generator(options.seed) {}
+
+    ~MockBackend() override {
+        {
+            std::lock_guard<std::mutex> lock(_timer_mutex);
+            _stopping = true;
+        }
+        _timer_cv.notify_all();
+        if (_timer.joinable()) _timer.join();
+    }
+
+    MockBackend(const MockBackend&) = delete;
+    MockBackend& operator=(const MockBackend&) = delete;
+
+    std::string name() const override { return "mock"; }
+
+    void open() override {
+        _timer = std::thread([this] { timer_loop(); });
+        log_event("MOCK: In-memory backend with " + std::to_string(_shards.size()) + " shard(s)");
+    }
+
+    std::optional<std::string> get(const std::string& key) override {
+        delay(_options.read_latency);
+        return lookup(key);
+    }
+
+    std::vector<std::optional<std::string>> multi_get(const std::vector<std::string>& keys) override {
+        delay(_options.read_latency);
+        return lookup_all(keys);
+    }
+
+    void multi_get_async(const std::vector<std::string>& keys, MultiGetCallback done) override {
+        auto due = std::chrono::steady_clock::now() + sample(_options.read_latency);
+        {
+            std::lock_guard<std::mutex> lock(_timer_mutex);
+            // Values are read when the timer fires, as if the query ran then
+            _timers.push(Timer{due, _timer_seq++, [this, keys, done] { done(lookup_all(keys), nullptr); }});
+        }
+        _timer_cv.notify_one();
+    }
+
+    std::vector<std::pair<std::string, std::string>> scan(const std::string& prefix,
+                                                          const std::optional<std::string>& start_after,
+                                                          size_t limit) override {
+        delay(_options.scan_latency);
+        // Take up to limit candidates from every shard, then merge
+        std::vector<std::pair<std::string, std::string>> entries;
+        for (auto& shard : _shards) {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            auto it = start_after && *start_after >= prefix ? shard.data.upper_bound(*start_after)
+                                                            : shard.data.lower_bound(prefix);
+            for (size_t taken = 0; it != shard.data.end() && taken < limit; ++it, ++taken) {
+                if (it->first.compare(0, prefix.size(), prefix) != 0) break;
+                entries.emplace_back(it->first, it->second);
+            }
+        }
+        std::sort(entries.begin(), entries.end());
+        if (entries.size() > limit) entries.resize(limit);
+        return entries;
+    }
+
+    // Applied op by op; a concurrent reader may see part of a batch
+    std::vector<bool> batch(const std::vector<WriteOp>& ops, bool /*durable*/) override {
+        delay(_options.write_latency);
+        std::vector<bool> results;
+        results.reserve(ops.size());
+        for (const auto& op : ops) {
+            Shard& shard = shard_for(op.key);
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            if (op.kind == WriteOp::Kind::Put) {
+                shard.data[op.key] = op.value;
+                results.push_back(true);
+            } else {
+                results.push_back(shard.data.erase(op.key) > 0);
+            }
+        }
+        return results;
+    }
+
+private:
+    struct Shard {
+        std::mutex mutex;
+        std::map<std::string, std::string> data;
+    };
+
+    struct Timer {
+        std::chrono::steady_clock::time_point due;
+        uint64_t seq; // FIFO among equal deadlines
+        std::function<void()> fire;
+
+        bool operator>(const Timer& other) const {
+            return due != other.due ? due > other.due : seq > other.seq;
+        }
+    };
+
+    Options _options;
+    std::vector<Shard> _shards;
+    std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> _timers;
+    uint64_t _timer_seq = 0;
+    bool _stopping = false;
+    std::mutex _timer_mutex;
+    std::condition_variable _timer_cv;
+    std::thread _timer;
+    std::mt19937_64 _generator;
+    std::mutex _generator_mutex;
+
+    Shard& shard_for(const std::string& key) {
+        return _shards[std::hash<std::string>{}(key) % _shards.size()];
+    }
+
+    std::optional<std::string> lookup(const std::string& key) {
+        Shard& shard = shard_for(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.data.find(key);
+        if (it == shard.data.end()) return std::nullopt;
+        return it->second;
+    }
+
+    std::vector<std::optional<std::string>> lookup_all(const std::vector<std::string>& keys) {
+        std::vector<std::optional<std::string>> values;
+        values.reserve(keys.size());
+        for (const auto& key : keys) values.push_back(lookup(key));
+        return values;
+    }
+
+    std::chrono::microseconds sample(const LatencyModel& model) {
+        std::lock_guard<std::mutex> lock(_generator_mutex);
+        return model.sample(_generator);
+    }
+
+    void delay(const LatencyModel& model) {
+        auto latency = sample(model);
+        if (latency.count() > 0) std::this_thread::sleep_for(latency);
+    }
+
+    void timer_loop() {
+        std::unique_lock<std::mutex> lock(_timer_mutex);
+        while (!_stopping) {
+            if (_timers.empty()) {
+                _timer_cv.wait(lock);
+                continue;
+            }
+            if (std::chrono::steady_clock::now() < _timers.top().due) {
+                _timer_cv.wait_until(lock, _timers.top().due);
+                continue;
+            }
+            auto fire = std::move(const_cast<Timer&>(_timers.top()).fire);
+            _timers.pop();
+            lock.unlock();
+            fire();
+            lock.lock();
+        }
+    }
+};
@@ -0,0 +1,197 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <iterator>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Online miss-ratio curve estimation using fixed-size SHARDS sampling
+// (Waldspurger et al., FAST '15).
+//
+// A key is sampled when hash(key) mod P < T, giving a sampling rate R = T/P.
+// For sampled keys only, it tracks the last access time in a Fenwick tree
+// indexed by logical time. The number of distinct sampled keys touched
+// since that access, divided by R, estimates the LRU reuse (stack) distance
+// on the full stream. Tracked keys hold no values, so they act as ghost
+// entries well beyond the real cache size. When more than max_sampled_keys
+// are tracked, T is lowered to evict the keys with the largest hashes, and
+// the histogram is rescaled to the new rate. The curve applies the SHARDS_adj
+// correction: the gap between expected (reads * R) and sampled reads is
+// credited to the smallest bucket, which removes most of the bias caused by
+// hot keys falling in or out of the sample.
+class MRCProfiler {
+public:
+    MRCProfiler(double sampling_rate, size_t max_sampled_keys, size_t bucket_size, size_t bucket_count)
+        : _threshold(static_cast<uint64_t>(sampling_rate * MODULUS)),
+          _max_sampled_keys(max_sampled_keys),
+          _bucket_size(bucket_size),
+          _histogram(bucket_count, 0.0),
+          _fenwick(max_sampled_keys * 4 + 1, 0) {
+        if (_threshold == 0) _threshold = 1;
+        if (_threshold > MODULUS) _threshold = MODULUS;
+    }
+
+    // Record one reference to key. Only reads are counted in the curve;
+    // writes still count as accesses since they also place the key in the cache.
+    void record(const std::string& key, bool is_read) {
+        if (is_read) _total_reads.fetch_add(1, std::memory_order_relaxed);
+        uint64_t h = hash(key) & (MODULUS - 1);
+        if (h >= _threshold) return; // Fast path: not sampled, no lock taken
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (h >= _threshold) return; // Threshold may have been lowered meanwhile
+
+        if (_tick + 1 >= _fenwick.size()) compact();
+        uint64_t now = ++_tick;
+
+        auto it = _keys.find(key);
+        if (it == _keys.end()) {
+            if (is_read) _cold_misses += 1.0;
+            _keys.emplace(key, Tracked{h, now});
+            _by_hash.emplace(h, key);
+            fenwick_add(now, 1);
+            if (_keys.size() > _max_sampled_keys) lower_threshold();
+        } else {
+            uint64_t last = it->second.last_tick;
+            if (is_read) {
+                // Distinct sampled keys accessed strictly after the previous access
+                int64_t distance = fenwick_sum(now - 1) - fenwick_sum(last);
+                double scaled = static_cast<double>(distance) * MODULUS / static_cast<double>(_threshold);
+                size_t bucket = static_cast<size_t>(scaled) / _bucket_size;
+                if (bucket < _histogram.size()) {
+                    _histogram[bucket] += 1.0;
+                } else {
+                    _overflow += 1.0;
+                }
+            }
+            fenwick_add(last, -1);
+            fenwick_add(now, 1);
+            it->second.last_tick = now;
+        }
+    }
+
+    // Estimated LRU hit ratio for each requested cache size (in entries)
+    std::vector<std::pair<size_t, double>> hit_ratio_curve(const std::vector<size_t>& sizes) {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        double sampled = _cold_misses + _overflow;
+        for (double count : _histogram) sampled += count;
+        double expected = static_cast<double>(_total_reads.load()) * _threshold / MODULUS;
+        double total = std::max(expected, sampled);
+
+        std::vector<std::pair<size_t, double>> curve;
+        double hits = expected - sampled; // SHARDS_adj correction, applied to bucket 0
+        size_t next_bucket = 0;
+        for (size_t size : sizes) {
+            // Bucket b holds distances in [b*w, (b+1)*w); all hit once (b+1)*w <= size
+            size_t full_buckets = std::min(size / _bucket_size, _histogram.size());
+            for (; next_bucket < full_buckets; ++next_bucket) hits += _histogram[next_bucket];
+            double ratio = size >= _bucket_size && total > 0.0 ? hits / total : 0.0;
+            curve.emplace_back(size, std::min(1.0, std::max(0.0, ratio)));
+        }
+        return curve;
+    }
+
+    // Largest cache size the histogram can resolve
+    size_t max_size() const { return _bucket_size * _histogram.size(); }
+
+    double sampling_rate() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return static_cast<double>(_threshold) / MODULUS;
+    }
+
+    size_t sampled_keys() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _keys.size();
+    }
+
+    // Reads seen on the full (unsampled) stream
+    uint64_t total_reads() const { return _total_reads.load(); }
+
+private:
+    static constexpr uint64_t MODULUS = uint64_t(1) << 24;
+
+    struct Tracked {
+        uint64_t hash;
+        uint64_t last_tick;
+    };
+
+    std::mutex _mutex;
+    std::atomic<uint64_t> _threshold;
+    std::atomic<uint64_t> _total_reads{0};
+    size_t _max_sampled_keys;
+    size_t _bucket_size;
+    std::vector<double> _histogram; // Read reuse distances, in buckets of _bucket_size entries
+    double _cold_misses = 0.0;      // First reads of a sampled key (infinite distance)
+    double _overflow = 0.0;         // Distances beyond the histogram range
+    std::unordered_map<std::string, Tracked> _keys;  // Sampled (ghost) keys
+    std::set<std::pair<uint64_t, std::string>> _by_hash; // For evicting the largest hashes
+    std::vector<int64_t> _fenwick; // 1 at the last access tick of each tracked key
+    uint64_t _tick = 0;
+
+    // FNV-1a followed by a murmur3 finalizer for well-mixed low bits
+    static uint64_t hash(const std::string& key) {
+        uint64_t h = 1469598103934665603ULL;
+        for (unsigned char c : key) {
+            h ^= c;
+            h *= 1099511628211ULL;
+        }
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33;
+        return h;
+    }
+
+    void fenwick_add(uint64_t i, int64_t delta) {
+        for (; i < _fenwick.size(); i += i & (~i + 1)) _fenwick[i] += delta;
+    }
+
+    int64_t fenwick_sum(uint64_t i) const {
+        int64_t sum = 0;
+        for (; i > 0; i -= i & (~i + 1)) sum += _fenwick[i];
+        return sum;
+    }
+
+    // Logical time ran out: renumber tracked keys 1..n keeping their order
+    void compact() {
+        std::vector<std::pair<uint64_t, Tracked*>> order;
+        order.reserve(_keys.size());
+        for (auto& entry : _keys) order.emplace_back(entry.second.last_tick, &entry.second);
+        std::sort(order.begin(), order.end(),
+                  [](const auto& a, const auto& b) { return a.first < b.first; });
+
+        std::fill(_fenwick.begin(), _fenwick.end(), 0);
+        _tick = 0;
+        for (auto& entry : order) {
+            entry.second->last_tick = ++_tick;
+            fenwick_add(_tick, 1);
+        }
+    }
+
+    // Drop the keys with the largest hash and lower T to it, rescaling
+    // the existing counts so they stay consistent with the new rate
+    void lower_threshold() {
+        uint64_t new_threshold = _by_hash.rbegin()->first;
+        while (!_by_hash.empty() && _by_hash.rbegin()->first >= new_threshold) {
+            auto last = std::prev(_by_hash.end());
+            auto it = _keys.find(last->second);
+            fenwick_add(it->second.last_tick, -1);
+            _keys.erase(it);
+            _by_hash.erase(last);
+        }
+
+        double scale = static_cast<double>(new_threshold) / static_cast<double>(_threshold);
+        for (double& count : _histogram) count *= scale;
+        _cold_misses *= scale;
+        _overflow *= scale;
+        _threshold = new_threshold;
+    }
+};
@@ -0,0 +1,671 @@
+#pragma once
+
+#include <pqxx/pqxx>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include "async_db.h"
+#include "db_pool.h"
+#include "json.hpp"
+#include "logger.h"
+#include "storage_backend.h"
+
+// StorageBackend on the kv_store table.
+//
+// Writes and scans run on a pool of blocking pqxx connections; multi_get_async
+// runs on the non-blocking AsyncDBExecutor, so cache-miss batches never hold a
+// thread while Postgres answers. Every statement is prepared once per
+// connection. A non-durable batch commits with synchronous_commit off: the
+// commit returns before the Postgres WAL flush, so a database crash may lose
+// the last few hundred milliseconds of such writes.
+//
+// With binary_values, kv_store.value is BYTEA and values travel in libpq
+// binary format both ways: upserts send the values as one binary bytea[]
+// parameter and cache-miss reads ask for binary results, so arbitrary bytes
+// are stored as-is with no hex escaping or decoding on either side.
+//
+// With a notify_channel, every write batch also publishes the keys it touched
+// with pg_notify() inside its transaction, so other server instances sharing
+// the table (InvalidationListener) hear about them exactly when they commit.
+// Keys that are not valid UTF-8 cannot be JSON strings without losing bytes,
+// so they travel hex-encoded in a separate "hex" array.
+//
+// Bulk imports stream rows with COPY into a per-connection temporary
+// staging table (created when the connection opens, emptied on commit) and
+// then merge them into kv_store with one upsert, all in one transaction.
+//
+// Cursors (exports) declare a server-side cursor in a read-only transaction
+// on a pooled connection they hold until destroyed, and FETCH from it in
+// batches: one consistent snapshot, never materialized in full on either side.
+//
+// With read replicas, cache-miss reads are spread round-robin over them
+// while writes, scans and blocking reads stay on the primary. A key written
+// through this backend (or reported by note_external_writes) is read from
+// the primary for read_your_writes_window afterwards, so replica lag never
+// hands back the value it just replaced. A failed replica read is retried on
+// the primary.
+class PostgresBackend : public StorageBackend {
+public:
+    struct Options {
+        std::string connection_string;
+        size_t pool_size;
+        std::chrono::milliseconds pool_wait_timeout;
+        std::chrono::milliseconds health_check_idle;
+        size_t async_connections;
+        std::chrono::milliseconds async_query_timeout{5000};
+        bool binary_values = false;
+        std::string notify_channel; // Empty: publish no invalidations
+        std::string instance_id; // Origin tag, so an instance can skip its own notifications
+        std::vector<std::string> replicas; // Read-only replica connection strings
+        std::chrono::milliseconds read_your_writes_window{5000};
+    };
+
+    // pg_notify payloads must stay under 8000 bytes
+    static constexpr size_t NOTIFY_PAYLOAD_LIMIT = 7900;
+
+    explicit PostgresBackend(const Options& options)
+        : _binary(options.binary_values),
+          _notify_channel(options.notify_channel),
+          _instance_id(options.instance_id),
+          _pool(options.connection_string, options.pool_size, options.pool_wait_timeout,
+                options.health_check_idle,
+                [binary = _binary](pqxx::connection& conn) {
+                    prepare_statements(conn, binary);
+                    prepare_import(conn, binary);
+                }),
+          _async(options.connection_string, options.async_connections, statements(_binary),
+                 options.pool_wait_timeout, options.async_query_timeout),
+          _read_your_writes_window(options.read_your_writes_window) {
+        for (const auto& replica : options.replicas) {
+            _replicas.push_back(std::make_unique<AsyncDBExecutor>(replica, options.async_connections,
+                                                                  read_statements(), options.pool_wait_timeout,
+                                                                  options.async_query_timeout));
+        }
+    }
+
+    std::string name() const override { return "postgres"; }
+
+    void open() override {
+        _pool.acquire();
+        log_event("POSTGRES: Connected (pool size " + std::to_string(_pool.size()) + ", " +
+                  std::to_string(_replicas.size()) + " read replica(s))");
+    }
+
+    std::optional<std::string> get(const std::string& key) override {
+        return multi_get({key}).front();
+    }
+
+    // Keys a text column cannot hold are never stored, so they are answered
+    // as missing without a query; one of them in the array would fail the
+    // statement for every other key.
+    std::vector<std::optional<std::string>> multi_get(const std::vector<std::string>& keys) override {
+        std::vector<std::string> storable;
+        for (const auto& key : keys) {
+            if (is_text(key)) storable.push_back(key);
+        }
+        Found found;
+        if (!storable.empty()) {
+            leased([&](pqxx::connection& conn) {
+                pqxx::nontransaction txn(conn);
+                for (const auto& row : txn.exec_prepared("kv_select_many", storable)) {
+                    found[row[0].as<std::string>()] = value_of(row[1]);
+                }
+            });
+        }
+        return collect(keys, found);
+    }
+
+    // Duplicate keys are fetched once and fanned out to each position, and
+    // keys a text column cannot hold are missing, as in multi_get(). With
+    // replicas, recently written keys are looked up on the primary and the
+    // rest on the next replica, in parallel.
+    void multi_get_async(const std::vector<std::string>& keys, MultiGetCallback done) override {
+        struct Gather {
+            std::mutex mutex;
+            Found found;
+            size_t remaining = 0;
+            std::string error;
+        };
+        auto gather = std::make_shared<Gather>();
+        for (const auto& key : keys) gather->found.emplace(key, std::nullopt);
+
+        std::vector<std::string> primary_keys, replica_keys;
+        for (const auto& entry : gather->found) {
+            if (!is_text(entry.first)) continue;
+            bool replica = !_replicas.empty() && !recently_written(entry.first);
+            (replica ? replica_keys : primary_keys).push_back(entry.first);
+        }
+        gather->remaining = (primary_keys.empty() ? 0 : 1) + (replica_keys.empty() ? 0 : 1);
+        if (gather->remaining == 0) {
+            done(collect(keys, gather->found), nullptr);
+            return;
+        }
+
+        auto part_done = [keys, gather, done](std::optional<Found> part, const std::string& error) {
+            bool last;
+            {
+                std::lock_guard<std::mutex> lock(gather->mutex);
+                if (!part) {
+                    if (gather->error.empty()) gather->error = error.empty() ? "query failed" : error;
+                } else {
+                    for (auto& entry : *part) gather->found[entry.first] = std::move(entry.second);
+                }
+                last = --gather->remaining == 0;
+            }
+            if (!last) return;
+            if (!gather->error.empty()) {
+                done({}, std::make_exception_ptr(std::runtime_error(gather->error)));
+            } else {
+                done(collect(keys, gather->found), nullptr);
+            }
+        };
+
+        if (!primary_keys.empty()) select_many(_async, primary_keys, part_done);
+        if (!replica_keys.empty()) {
+            AsyncDBExecutor& replica = *_replicas[_next_replica++ % _replicas.size()];
+            select_many(replica, replica_keys,
+                [this, replica_keys, part_done](std::optional<Found> part, const std::string& error) {
+                    if (part) {
+                        part_done(std::move(part), "");
+                        return;
+                    }
+                    log_event("POSTGRES: Replica read failed (" + error + "), retrying on the primary");
+                    select_many(_async, replica_keys, part_done);
+                });
+        }
+    }
+
+    std::unique_ptr<StorageCursor> open_cursor(const std::string& prefix) override {
+        return std::make_unique<Cursor>(*this, prefix);
+    }
+
+    // COPY the rows (last one per key) into kv_import, then merge with the
+    // same unchanged-value guard as kv_upsert_batch
+    void bulk_put(const std::vector<std::pair<std::string, std::string>>& rows) override {
+        if (rows.empty()) return;
+        std::unordered_map<std::string, size_t> last_row;
+        for (size_t i = 0; i < rows.size(); ++i) last_row[rows[i].first] = i;
+
+        std::vector<WriteOp> written; // For notifications and read-your-writes
+        written.reserve(last_row.size());
+        leased([&](pqxx::connection& conn) {
+            pqxx::work txn(conn);
+            {
+                auto stream = pqxx::stream_to::table(txn, {"kv_import"}, {"key", "value"});
+                for (size_t i = 0; i < rows.size(); ++i) {
+                    if (last_row[rows[i].first] != i) continue;
+                    if (_binary) {
+                        stream.write_values(rows[i].first, pqxx::binary_cast(rows[i].second));
+                    } else {
+                        stream.write_values(rows[i].first, rows[i].second);
+                    }
+                    written.push_back(WriteOp{WriteOp::Kind::Put, rows[i].first, ""});
+                }
+                stream.complete();
+            }
+            txn.exec_prepared("kv_import_merge");
+            if (!_notify_channel.empty()) publish(txn, written);
+            txn.commit();
+        });
+
+        if (!_replicas.empty()) {
+            std::vector<std::string> keys;
+            keys.reserve(written.size());
+            for (const auto& op : written) keys.push_back(op.key);
+            record_writes(keys);
+        }
+    }
+
+    // Keys changed by another writer (e.g. heard through NOTIFY): read them
+    // from the primary for a while, like local writes
+    void note_external_writes(const std::vector<std::string>& keys) override {
+        if (!_replicas.empty()) record_writes(keys);
+    }
+
+    // The range starts at prefix, or just after start_after if that is
+    // later. Keys are text, so never hold a NUL byte: the first key after
+    // start_after is at least start_after + "\x01", an inclusive bound.
+    std::vector<std::pair<std::string, std::string>> scan(const std::string& prefix,
+                                                          const std::optional<std::string>& start_after,
+                                                          size_t limit) override {
+        std::vector<std::pair<std::string, std::string>> entries;
+        std::string begin = prefix;
+        if (start_after && *start_after >= prefix) begin = *start_after + '\x01';
+        std::string end = prefix_successor(prefix);
+        leased([&](pqxx::connection& conn) {
+            pqxx::nontransaction txn(conn);
+            auto rows = end.empty()
+                            ? txn.exec_prepared("kv_scan_from", begin, static_cast<long long>(limit))
+                            : txn.exec_prepared("kv_scan", begin, end, static_cast<long long>(limit));
+            for (const auto& row : rows) {
+                entries.emplace_back(row[0].as<std::string>(), value_of(row[1]));
+            }
+        });
+        return entries;
+    }
+
+    // Runs of consecutive puts become one unnest upsert (keeping the last
+    // value of a key repeated within the run, since ON CONFLICT cannot touch
+    // a row twice in one command). A put of the value a row already holds
+    // leaves the row alone: no new tuple version, WAL record or dead tuple.
+    // Runs of deletes become one ANY() delete whose RETURNING list tells
+    // each op whether its key existed. Data errors (SQLSTATE class 22, e.g.
+    // a NUL byte or invalid UTF-8 in a text value, and constraint
+    // violations) become RejectedWrite.
+    std::vector<bool> batch(const std::vector<WriteOp>& ops, bool durable) override {
+        std::vector<bool> results(ops.size(), true);
+        if (ops.empty()) return results;
+
+        try {
+            leased([&](pqxx::connection& conn) {
+                pqxx::work txn(conn);
+                if (!durable) txn.exec_prepared("kv_async_commit");
+
+                size_t i = 0;
+                while (i < ops.size()) {
+                    size_t end = i;
+                    while (end < ops.size() && ops[end].kind == ops[i].kind) ++end;
+                    if (ops[i].kind == WriteOp::Kind::Put) {
+                        upsert_run(txn, ops, i, end, _binary);
+                    } else {
+                        delete_run(txn, ops, i, end, results);
+                    }
+                    i = end;
+                }
+                if (!_notify_channel.empty()) publish(txn, ops);
+                txn.commit();
+            });
+        } catch (const pqxx::data_exception& e) {
+            throw RejectedWrite(e.what());
+        } catch (const pqxx::integrity_constraint_violation& e) {
+            throw RejectedWrite(e.what());
+        }
+
+        if (!_replicas.empty()) {
+            std::vector<std::string> keys;
+            keys.reserve(ops.size());
+            for (const auto& op : ops) keys.push_back(op.key);
+            record_writes(keys);
+        }
+        return results;
+    }
+
+private:
+    class Cursor : public StorageCursor {
+    public:
+        Cursor(PostgresBackend& backend, const std::string& prefix)
+            : _backend(backend), _conn(backend._pool.acquire()), _txn(*_conn) {
+            std::string end = prefix_successor(prefix);
+            try {
+                _txn.exec("DECLARE kv_export NO SCROLL CURSOR FOR SELECT key, value FROM kv_store "
+                          "WHERE key COLLATE \"C\" >= " + _txn.quote(prefix) +
+                          (end.empty() ? "" : " AND key COLLATE \"C\" < " + _txn.quote(end)) +
+                          " ORDER BY key COLLATE \"C\"");
+            } catch (const pqxx::broken_connection&) {
+                _conn.mark_broken();
+                throw;
+            }
+        }
+
+        std::vector<std::pair<std::string, std::string>> next(size_t max_rows) override {
+            std::vector<std::pair<std::string, std::string>> entries;
+            if (_done) return entries;
+            pqxx::result rows;
+            try {
+                rows = _txn.exec("FETCH FORWARD " + std::to_string(max_rows) + " FROM kv_export");
+            } catch (const pqxx::broken_connection&) {
+                _conn.mark_broken();
+                throw;
+            }
+            for (const auto& row : rows) {
+                entries.emplace_back(row[0].as<std::string>(), _backend.value_of(row[1]));
+            }
+            if (entries.size() < max_rows) _done = true;
+            return entries;
+        }
+
+    private:
+        PostgresBackend& _backend;
+        DBConnectionPool::Lease _conn; // Held for the cursor's lifetime
+        pqxx::read_transaction _txn; // Aborted (closing the cursor) on destruction
+        bool _done = false;
+    };
+
+    bool _binary;
+    std::string _notify_channel;
+    std::string _instance_id;
+    DBConnectionPool _pool;
+    AsyncDBExecutor _async;
+    std::vector<std::unique_ptr<AsyncDBExecutor>> _replicas;
+    std::atomic<size_t> _next_replica{0};
+
+    // Keys written within the read-your-writes window: last write time per
+    // key, plus the writes in time order for expiry
+    std::chrono::milliseconds _read_your_writes_window;
+    std::mutex _recent_mutex;
+    std::unordered_map<std::string, std::chrono::steady_clock::time_point> _recent_writes;
+    std::deque<std::pair<std::chrono::steady_clock::time_point, std::string>> _recent_order;
+
+    using Found = std::unordered_map<std::string, std::optional<std::string>>;
+
+    // Runs work on a pooled connection. One that broke under it is discarded
+    // instead of going back to the pool, so the next checkout reconnects.
+    void leased(const std::function<void(pqxx::connection&)>& work) {
+        auto conn = _pool.acquire();
+        try {
+            work(*conn);
+        } catch (const pqxx::broken_connection&) {
+            conn.mark_broken();
+            throw;
+        }
+    }
+    using FoundCallback = std::function<void(std::optional<Found> found, const std::string& error)>;
+
+    // Every statement the backend runs, prepared once on each connection.
+    // New operations should add their SQL here and call it with exec_prepared().
+    static std::vector<std::pair<std::string, std::string>> statements(bool binary) {
+        std::string value_type = binary ? "bytea" : "text";
+        return {
+            {"kv_upsert_batch", "INSERT INTO kv_store (key, value) "
+                                "SELECT * FROM unnest($1::text[], $2::" + value_type + "[]) "
+                                "ON CONFLICT (key) DO UPDATE SET value = EXCLUDED.value "
+                                "WHERE kv_store.value IS DISTINCT FROM EXCLUDED.value"},
+            {"kv_select_many", "SELECT key, value FROM kv_store WHERE key = ANY($1::text[])"},
+            {"kv_delete", "DELETE FROM kv_store WHERE key = $1"},
+            {"kv_delete_many", "DELETE FROM kv_store WHERE key = ANY($1::text[]) RETURNING key"},
+            // Prefix scans are key ranges [prefix, successor) compared and
+            // ordered bytewise, so a "C"-collated key index serves them
+            // whatever the database's collation
+            {"kv_scan", "SELECT key, value FROM kv_store WHERE key COLLATE \"C\" >= $1 "
+                        "AND key COLLATE \"C\" < $2 ORDER BY key COLLATE \"C\" LIMIT $3"},
+            {"kv_scan_from", "SELECT key, value FROM kv_store WHERE key COLLATE \"C\" >= $1 "
+                             "ORDER BY key COLLATE \"C\" LIMIT $2"},
+            {"kv_async_commit", "SELECT set_config('synchronous_commit', 'off', true)"},
+            {"kv_notify", "SELECT pg_notify($1, $2)"},
+        };
+    }
+
+    // Staging table for bulk_put and its merge. Session-local, so it cannot
+    // join the statement table the async and replica connections prepare.
+    static void prepare_import(pqxx::connection& conn, bool binary) {
+        {
+            pqxx::nontransaction txn(conn);
+            txn.exec(std::string("CREATE TEMP TABLE IF NOT EXISTS kv_import (key text, value ") +
+                     (binary ? "bytea" : "text") + ") ON COMMIT DELETE ROWS");
+        }
+        conn.prepare("kv_import_merge", "INSERT INTO kv_store (key, value) SELECT key, value FROM kv_import "
+                                        "ON CONFLICT (key) DO UPDATE SET value = EXCLUDED.value "
+                                        "WHERE kv_store.value IS DISTINCT FROM EXCLUDED.value");
+    }
+
+    // The subset a read-only replica needs
+    static std::vector<std::pair<std::string, std::string>> read_statements() {
+        std::vector<std::pair<std::string, std::string>> reads;
+        for (auto& statement : statements(false)) {
+            if (statement.first == "kv_select_many") reads.push_back(std::move(statement));
+        }
+        return reads;
+    }
+
+    static void prepare_statements(pqxx::connection& conn, bool binary) {
+        for (const auto& statement : statements(binary)) {
+            conn.prepare(statement.first, statement.second);
+        }
+    }
+
+    // Look up distinct keys on one executor; found is std::nullopt on failure.
+    // Binary results: text columns arrive as their raw bytes, bytea without hex encoding.
+    static void select_many(AsyncDBExecutor& executor, const std::vector<std::string>& keys, FoundCallback done) {
+        executor.execute("kv_select_many", {AsyncDBExecutor::to_array_literal(keys)},
+            [done](AsyncResult res) {
+                if (!res.ok) {
+                    done(std::nullopt, res.error);
+                    return;
+                }
+                Found found;
+                for (auto& row : res.rows) {
+                    if (row.size() == 2 && row[0]) found[*row[0]] = std::move(row[1]);
+                }
+                done(std::move(found), "");
+            },
+            AsyncDBExecutor::ResultFormat::Binary);
+    }
+
+    void record_writes(const std::vector<std::string>& keys) {
+        auto now = std::chrono::steady_clock::now();
+        std::lock_guard<std::mutex> lock(_recent_mutex);
+        for (const auto& key : keys) {
+            _recent_writes[key] = now;
+            _recent_order.emplace_back(now, key);
+        }
+        // Forget writes that left the window, unless the key was written again
+        while (!_recent_order.empty() && now - _recent_order.front().first >= _read_your_writes_window) {
+            auto it = _recent_writes.find(_recent_order.front().second);
+            if (it != _recent_writes.end() && it->second == _recent_order.front().first) _recent_writes.erase(it);
+            _recent_order.pop_front();
+        }
+    }
+
+    bool recently_written(const std::string& key) {
+        std::lock_guard<std::mutex> lock(_recent_mutex);
+        auto it = _recent_writes.find(key);
+        return it != _recent_writes.end() &&
+               std::chrono::steady_clock::now() - it->second < _read_your_writes_window;
+    }
+
+    static std::vector<std::optional<std::string>> collect(
+        const std::vector<std::string>& keys,
+        Found& found) {
+        std::vector<std::optional<std::string>> values;
+        values.reserve(keys.size());
+        for (const auto& key : keys) values.push_back(found[key]);
+        return values;
+    }
+
+    // Values from pqxx come back in text format; bytea needs unescaping
+    std::string value_of(const pqxx::field& field) const {
+        if (!_binary) return field.as<std::string>();
+        auto bytes = field.as<pqxx::bytes>();
+        return std::string(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+    }
+
+    static void put_be32(std::string& out, uint32_t value) {
+        for (int shift = 24; shift >= 0; shift -= 8) out += static_cast<char>((value >> shift) & 0xFF);
+    }
+
+    // A one-dimensional bytea[] in Postgres' binary array format (array_recv):
+    // ndim, has-nulls flag, element OID, length and lower bound, then each
+    // element as a length-prefixed byte string, all integers big-endian
+    static std::string bytea_array(const std::vector<std::string>& values) {
+        const uint32_t BYTEA_OID = 17;
+        size_t total = 20;
+        for (const auto& value : values) total += 4 + value.size();
+        std::string out;
+        out.reserve(total);
+        put_be32(out, 1);
+        put_be32(out, 0);
+        put_be32(out, BYTEA_OID);
+        put_be32(out, static_cast<uint32_t>(values.size()));
+        put_be32(out, 1);
+        for (const auto& value : values) {
+            put_be32(out, static_cast<uint32_t>(value.size()));
+            out += value;
+        }
+        return out;
+    }
+
+    static void upsert_run(pqxx::work& txn, const std::vector<WriteOp>& ops, size_t begin, size_t end,
+                           bool binary) {
+        std::unordered_map<std::string, size_t> last_write;
+        for (size_t i = begin; i < end; ++i) last_write[ops[i].key] = i;
+
+        std::vector<std::string> keys, values;
+        keys.reserve(last_write.size());
+        values.reserve(last_write.size());
+        for (size_t i = begin; i < end; ++i) {
+            if (last_write[ops[i].key] != i) continue;
+            keys.push_back(ops[i].key);
+            values.push_back(ops[i].value);
+        }
+        if (binary) {
+            // pqxx sends byte strings as binary-format parameters
+            std::string array = bytea_array(values);
+            txn.exec_prepared("kv_upsert_batch", keys, pqxx::binary_cast(array));
+        } else {
+            txn.exec_prepared("kv_upsert_batch", keys, values);
+        }
+    }
+
+    // Queue notifications naming every key the batch wrote, packed into as
+    // few payloads as fit; Postgres delivers them only if the transaction
+    // commits. A key too long for any payload asks listeners to drop everything.
+    void publish(pqxx::work& txn, const std::vector<WriteOp>& ops) const {
+        std::unordered_set<std::string> seen;
+        nlohmann::json keys = nlohmann::json::array();
+        nlohmann::json hex_keys = nlohmann::json::array(); // Keys that are not valid UTF-8
+        size_t size = 0;
+        auto flush = [&](nlohmann::json payload) {
+            payload["origin"] = _instance_id;
+            // Keys are valid UTF-8 by now; replace only guards the origin tag
+            txn.exec_prepared("kv_notify", _notify_channel,
+                              payload.dump(-1, ' ', false, nlohmann::json::error_handler_t::replace));
+        };
+        auto flush_keys = [&] {
+            nlohmann::json payload = nlohmann::json::object();
+            if (!keys.empty()) payload["keys"] = std::move(keys);
+            if (!hex_keys.empty()) payload["hex"] = std::move(hex_keys);
+            flush(std::move(payload));
+            keys = nlohmann::json::array();
+            hex_keys = nlohmann::json::array();
+            size = 0;
+        };
+        for (const auto& op : ops) {
+            if (!seen.insert(op.key).second) continue;
+            std::string hex;
+            size_t key_size;
+            try {
+                key_size = nlohmann::json(op.key).dump().size() + 1;
+            } catch (const nlohmann::json::type_error&) { // Invalid UTF-8
+                hex = to_hex(op.key);
+                key_size = hex.size() + 3;
+            }
+            if (key_size > NOTIFY_PAYLOAD_LIMIT - 100) {
+                flush({{"all", true}});
+                return;
+            }
+            if (size + key_size > NOTIFY_PAYLOAD_LIMIT - 100) flush_keys();
+            if (hex.empty()) {
+                keys.push_back(op.key);
+            } else {
+                hex_keys.push_back(std::move(hex));
+            }
+            size += key_size;
+        }
+        if (!keys.empty() || !hex_keys.empty()) flush_keys();
+    }
+
+    // Whether s can be stored in a text column: valid UTF-8 (no overlong
+    // forms or surrogates) without NUL bytes
+    static bool is_text(const std::string& s) {
+        for (size_t i = 0; i < s.size();) {
+            auto lead = static_cast<unsigned char>(s[i]);
+            if (lead == 0) return false;
+            size_t length = lead < 0x80 ? 1 : lead >= 0xF8 ? 0 : lead >= 0xF0 ? 4 : lead >= 0xE0 ? 3 : lead >= 0xC2 ? 2 : 0;
+            if (length == 0 || length > s.size() - i) return false;
+            uint32_t code = length == 1 ? lead : lead & (0x7F >> length);
+            for (size_t j = i + 1; j < i + length; ++j) {
+                auto c = static_cast<unsigned char>(s[j]);
+                if ((c & 0xC0) != 0x80) return false;
+                code = (code << 6) | (c & 0x3F);
+            }
+            static const uint32_t min_code[] = {0, 0, 0x80, 0x800, 0x10000};
+            if (code < min_code[length] || code > 0x10FFFF || (code >= 0xD800 && code <= 0xDFFF)) return false;
+            i += length;
+        }
+        return true;
+    }
+
+    // The smallest string above every string starting with prefix, the
+    // exclusive end of its key range; empty when there is no such bound
+    // (empty prefix, or nothing but U+10FFFF). Steps whole UTF-8 characters,
+    // since bumping a byte could produce text Postgres rejects.
+    static std::string prefix_successor(std::string prefix) {
+        while (!prefix.empty()) {
+            size_t start = prefix.size() - 1;
+            while (start > 0 && (static_cast<unsigned char>(prefix[start]) & 0xC0) == 0x80) --start;
+            auto lead = static_cast<unsigned char>(prefix[start]);
+            size_t length = lead < 0x80 ? 1 : lead >= 0xF0 ? 4 : lead >= 0xE0 ? 3 : lead >= 0xC0 ? 2 : 0;
+            if (length != prefix.size() - start) return ""; // Not UTF-8: leave the range open-ended
+            uint32_t code = length == 1 ? lead : lead & (0x7F >> length);
+            for (size_t i = start + 1; i < prefix.size(); ++i) {
+                code = (code << 6) | (static_cast<unsigned char>(prefix[i]) & 0x3F);
+            }
+            prefix.resize(start);
+            if (code >= 0x10FFFF) continue;
+            ++code;
+            if (code == 0xD800) code = 0xE000; // Surrogates are not characters
+            if (code < 0x80) {
+                prefix += static_cast<char>(code);
+            } else if (code < 0x800) {
+                prefix += static_cast<char>(0xC0 | (code >> 6));
+                prefix += static_cast<char>(0x80 | (code & 0x3F));
+            } else if (code < 0x10000) {
+                prefix += static_cast<char>(0xE0 | (code >> 12));
+                prefix += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+                prefix += static_cast<char>(0x80 | (code & 0x3F));
+            } else {
+                prefix += static_cast<char>(0xF0 | (code >> 18));
+                prefix += static_cast<char>(0x80 | ((code >> 12) & 0x3F));
+                prefix += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+                prefix += static_cast<char>(0x80 | (code & 0x3F));
+            }
+            return prefix;
+        }
+        return prefix;
+    }
+
+    static std::string to_hex(const std::string& bytes) {
+        static const char digits[] = "0123456789abcdef";
+        std::string hex;
+        hex.reserve(bytes.size() * 2);
+        for (unsigned char c : bytes) {
+            hex += digits[c >> 4];
+            hex += digits[c & 0xf];
+        }
+        return hex;
+    }
+
+    // Keys a text column cannot hold never existed, so they are left out of
+    // the statement rather than failing it. A key repeated within the run
+    // existed only for its first delete.
+    static void delete_run(pqxx::work& txn, const std::vector<WriteOp>& ops, size_t begin, size_t end,
+                           std::vector<bool>& results) {
+        std::vector<std::string> keys;
+        keys.reserve(end - begin);
+        for (size_t i = begin; i < end; ++i) {
+            if (is_text(ops[i].key)) keys.push_back(ops[i].key);
+        }
+        if (keys.size() == 1 && end - begin == 1) {
+            results[begin] = txn.exec_prepared("kv_delete", keys.front()).affected_rows() > 0;
+            return;
+        }
+        std::unordered_set<std::string> existed;
+        if (!keys.empty()) {
+            for (const auto& row : txn.exec_prepared("kv_delete_many", keys)) {
+                existed.insert(row[0].as<std::string>());
+            }
+        }
+        for (size_t i = begin; i < end; ++i) results[i] = existed.erase(ops[i].key) > 0;
+    }
+};
@@ -0,0 +1,390 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "logger.h"
+#include "storage_backend.h"
+
+// Hash-partitions keys across several StorageBackends (e.g. one
+// PostgresBackend, with its own pools, per database).
+//
+// Keys are placed on a consistent-hash ring: every shard owns
+// virtual_nodes points derived from its name, and a key belongs to the
+// first point at or after its own hash. The hash (FNV-1a with a 64-bit
+// finalizer) does not depend on the platform or process, so placement is
+// stable across restarts, and adding a shard only moves the keys that now
+// fall on its points (about 1/N of them). Shard names, not their order or
+// connection strings, decide placement.
+//
+// Multi-key calls are split per shard and the parts run in parallel on a
+// fixed set of worker threads and the calling thread. The caller runs any
+// part no worker has picked up yet, so a busy pool slows a call down but
+// never stalls it. A batch is atomic only within each shard: if one shard
+// fails, the others may already have committed their part, and the call
+// throws. If shards only rejected their part, the RejectedWrite says which
+// ops the other shards applied, so a caller can retry just the rest.
+//
+// Scans ask every shard and merge in byte order, which every backend's
+// scan() must use too (see StorageBackend::scan).
+class ShardedBackend : public StorageBackend {
+public:
+    struct Shard {
+        std::string name;
+        std::unique_ptr<StorageBackend> backend;
+    };
+
+    // workers: threads for the parts of multi-shard calls the caller does
+    // not run itself; 0 means two per extra shard
+    explicit ShardedBackend(std::vector<Shard> shards, size_t virtual_nodes = 128, size_t workers = 0)
+        : _shards(std::move(shards)) {
+        if (_shards.empty()) throw std::invalid_argument("ShardedBackend needs at least one shard");
+        for (size_t s = 0; s < _shards.size(); ++s) {
+            for (size_t v = 0; v < virtual_nodes; ++v) {
+                _ring.emplace_back(hash(_shards[s].name + "#" + std::to_string(v)), s);
+            }
+        }
+        std::sort(_ring.begin(), _ring.end());
+
+        if (workers == 0) workers = 2 * (_shards.size() - 1);
+        for (size_t i = 0; i < workers; ++i) _workers.emplace_back([this] { work_loop(); });
+    }
+
+    ~ShardedBackend() override {
+        {
+            std::lock_guard<std::mutex> lock(_work_mutex);
+            _stopping = true;
+        }
+        _work_cv.notify_all();
+        for (auto& worker : _workers) worker.join();
+    }
+
+    ShardedBackend(const ShardedBackend&) = delete;
+    ShardedBackend& operator=(const ShardedBackend&) = delete;
+
+    std::string name() const override {
+        return _shards.front().backend->name() + " x" + std::to_string(_shards.size());
+    }
+
+    void open() override {
+        for (auto& shard : _shards) {
+            shard.backend->open();
+            log_event("SHARDS: Shard '" + shard.name + "' ready");
+        }
+    }
+
+    // Index of the shard that owns key
+    size_t shard_for(const std::string& key) const {
+        auto it = std::lower_bound(_ring.begin(), _ring.end(), std::make_pair(hash(key), size_t(0)));
+        return it == _ring.end() ? _ring.front().second : it->second;
+    }
+
+    std::optional<std::string> get(const std::string& key) override {
+        return _shards[shard_for(key)].backend->get(key);
+    }
+
+    std::vector<std::optional<std::string>> multi_get(const std::vector<std::string>& keys) override {
+        auto groups = group(keys);
+        std::vector<std::optional<std::string>> values(keys.size());
+        fan_out(involved(groups), [&](size_t s) {
+            auto part = _shards[s].backend->multi_get(groups[s].keys);
+            for (size_t i = 0; i < part.size(); ++i) values[groups[s].positions[i]] = std::move(part[i]);
+        });
+        return values;
+    }
+
+    // Completes once every shard has answered; any shard error fails the whole call
+    void multi_get_async(const std::vector<std::string>& keys, MultiGetCallback done) override {
+        auto groups = std::make_shared<std::vector<Group>>(group(keys));
+        struct Gather {
+            std::mutex mutex;
+            std::vector<std::optional<std::string>> values;
+            std::exception_ptr error;
+            size_t remaining;
+        };
+        auto gather = std::make_shared<Gather>();
+        gather->values.resize(keys.size());
+        auto shards = involved(*groups);
+        gather->remaining = shards.size();
+        if (shards.empty()) {
+            done({}, nullptr);
+            return;
+        }
+
+        for (size_t s : shards) {
+            _shards[s].backend->multi_get_async((*groups)[s].keys,
+                [groups, gather, s, done](std::vector<std::optional<std::string>> part, std::exception_ptr error) {
+                    bool last;
+                    {
+                        std::lock_guard<std::mutex> lock(gather->mutex);
+                        if (error) {
+                            if (!gather->error) gather->error = error;
+                        } else {
+                            const auto& positions = (*groups)[s].positions;
+                            for (size_t i = 0; i < part.size() && i < positions.size(); ++i) {
+                                gather->values[positions[i]] = std::move(part[i]);
+                            }
+                        }
+                        last = --gather->remaining == 0;
+                    }
+                    if (!last) return;
+                    if (gather->error) {
+                        done({}, gather->error);
+                    } else {
+                        done(std::move(gather->values), nullptr);
+                    }
+                });
+        }
+    }
+
+    // Every shard holds part of the key space: ask all, merge in byte order
+    std::vector<std::pair<std::string, std::string>> scan(const std::string& prefix,
+                                                          const std::optional<std::string>& start_after,
+                                                          size_t limit) override {
+        std::vector<std::vector<std::pair<std::string, std::string>>> parts(_shards.size());
+        std::vector<size_t> all(_shards.size());
+        for (size_t s = 0; s < all.size(); ++s) all[s] = s;
+        fan_out(all, [&](size_t s) { parts[s] = _shards[s].backend->scan(prefix, start_after, limit); });
+
+        std::vector<std::pair<std::string, std::string>> entries;
+        for (auto& part : parts) {
+            for (auto& entry : part) entries.push_back(std::move(entry));
+        }
+        std::sort(entries.begin(), entries.end());
+        if (entries.size() > limit) entries.resize(limit);
+        return entries;
+    }
+
+    std::vector<bool> batch(const std::vector<WriteOp>& ops, bool durable) override {
+        std::vector<std::vector<WriteOp>> shard_ops(_shards.size());
+        std::vector<Group> groups(_shards.size());
+        for (size_t i = 0; i < ops.size(); ++i) {
+            size_t s = shard_for(ops[i].key);
+            shard_ops[s].push_back(ops[i]);
+            groups[s].keys.push_back(ops[i].key);
+            groups[s].positions.push_back(i);
+        }
+
+        std::vector<bool> results(ops.size(), true);
+        std::vector<bool> rejected(_shards.size(), false);
+        std::string rejection;
+        std::mutex results_mutex; // std::vector<bool> packs bits, so writes to it race
+        fan_out(involved(groups), [&](size_t s) {
+            std::vector<bool> part;
+            try {
+                part = _shards[s].backend->batch(shard_ops[s], durable);
+            } catch (const RejectedWrite& e) {
+                std::lock_guard<std::mutex> lock(results_mutex);
+                rejected[s] = true;
+                if (rejection.empty()) rejection = e.what();
+                return;
+            }
+            std::lock_guard<std::mutex> lock(results_mutex);
+            for (size_t i = 0; i < part.size(); ++i) results[groups[s].positions[i]] = part[i];
+        });
+
+        auto shards = involved(groups);
+        auto rejected_shards =
+            static_cast<size_t>(std::count_if(shards.begin(), shards.end(), [&](size_t s) { return rejected[s]; }));
+        if (rejected_shards == shards.size() && !shards.empty()) throw RejectedWrite(rejection);
+        if (rejected_shards > 0) {
+            std::vector<std::optional<bool>> applied(results.begin(), results.end());
+            for (size_t s : shards) {
+                if (!rejected[s]) continue;
+                for (size_t position : groups[s].positions) applied[position] = std::nullopt;
+            }
+            throw RejectedWrite(rejection, std::move(applied));
+        }
+        return results;
+    }
+
+    // Merges per-shard cursors in byte order
+    std::unique_ptr<StorageCursor> open_cursor(const std::string& prefix) override {
+        std::vector<std::unique_ptr<StorageCursor>> cursors;
+        for (auto& shard : _shards) cursors.push_back(shard.backend->open_cursor(prefix));
+        return std::make_unique<MergeCursor>(std::move(cursors));
+    }
+
+    // Atomic per shard only, like batch()
+    void bulk_put(const std::vector<std::pair<std::string, std::string>>& rows) override {
+        std::vector<std::vector<std::pair<std::string, std::string>>> shard_rows(_shards.size());
+        for (const auto& row : rows) shard_rows[shard_for(row.first)].push_back(row);
+        std::vector<size_t> shards;
+        for (size_t s = 0; s < shard_rows.size(); ++s) {
+            if (!shard_rows[s].empty()) shards.push_back(s);
+        }
+        fan_out(shards, [&](size_t s) { _shards[s].backend->bulk_put(shard_rows[s]); });
+    }
+
+    void note_external_writes(const std::vector<std::string>& keys) override {
+        auto groups = group(keys);
+        for (size_t s : involved(groups)) _shards[s].backend->note_external_writes(groups[s].keys);
+    }
+
+private:
+    class MergeCursor : public StorageCursor {
+    public:
+        explicit MergeCursor(std::vector<std::unique_ptr<StorageCursor>> cursors) {
+            for (auto& cursor : cursors) _sources.push_back(Source{std::move(cursor), {}, false});
+        }
+
+        std::vector<std::pair<std::string, std::string>> next(size_t max_rows) override {
+            std::vector<std::pair<std::string, std::string>> entries;
+            while (entries.size() < max_rows) {
+                Source* smallest = nullptr;
+                for (auto& source : _sources) {
+                    if (source.buffer.empty() && !source.done) {
+                        auto batch = source.cursor->next(max_rows);
+                        source.done = batch.size() < max_rows;
+                        for (auto& entry : batch) source.buffer.push_back(std::move(entry));
+                    }
+                    if (!source.buffer.empty() &&
+                        (!smallest || source.buffer.front().first < smallest->buffer.front().first)) {
+                        smallest = &source;
+                    }
+                }
+                if (!smallest) break; // Every shard exhausted
+                entries.push_back(std::move(smallest->buffer.front()));
+                smallest->buffer.pop_front();
+            }
+            return entries;
+        }
+
+    private:
+        struct Source {
+            std::unique_ptr<StorageCursor> cursor;
+            std::deque<std::pair<std::string, std::string>> buffer;
+            bool done;
+        };
+        std::vector<Source> _sources;
+    };
+
+    // One shard's slice of a multi-key call
+    struct Group {
+        std::vector<std::string> keys;
+        std::vector<size_t> positions; // Index of each key in the caller's vector
+    };
+
+    // One fan_out() call, shared with the workers that help run it
+    struct FanOut {
+        std::function<void(size_t)> fn; // Refers to the caller's frame: only run for claimed parts
+        std::vector<size_t> shards;
+        std::atomic<size_t> next{0}; // First unclaimed part
+        std::mutex mutex;
+        std::condition_variable finished;
+        size_t remaining;
+        std::exception_ptr error;
+    };
+
+    std::vector<Shard> _shards;
+    std::vector<std::pair<uint64_t, size_t>> _ring; // (point, shard index), sorted
+
+    std::mutex _work_mutex;
+    std::condition_variable _work_cv;
+    std::deque<std::shared_ptr<FanOut>> _work;
+    bool _stopping = false;
+    std::vector<std::thread> _workers;
+
+    static uint64_t hash(const std::string& s) {
+        uint64_t h = 14695981039346656037ULL; // FNV-1a
+        for (unsigned char c : s) {
+            h ^= c;
+            h *= 1099511628211ULL;
+        }
+        // splitmix64 finalizer: FNV alone clusters similar keys on the ring
+        h ^= h >> 30;
+        h *= 0xbf58476d1ce4e5b9ULL;
+        h ^= h >> 27;
+        h *= 0x94d049bb133111ebULL;
+        h ^= h >> 31;
+        return h;
+    }
+
+    std::vector<Group> group(const std::vector<std::string>& keys) const {
+        std::vector<Group> groups(_shards.size());
+        for (size_t i = 0; i < keys.size(); ++i) {
+            Group& g = groups[shard_for(keys[i])];
+            g.keys.push_back(keys[i]);
+            g.positions.push_back(i);
+        }
+        return groups;
+    }
+
+    // Shards with at least one key in groups
+    static std::vector<size_t> involved(const std::vector<Group>& groups) {
+        std::vector<size_t> shards;
+        for (size_t s = 0; s < groups.size(); ++s) {
+            if (!groups[s].keys.empty()) shards.push_back(s);
+        }
+        return shards;
+    }
+
+    // Run fn(shard) for every listed shard in parallel and rethrow the first
+    // failure once all have finished
+    template <typename Fn>
+    void fan_out(const std::vector<size_t>& shards, Fn fn) {
+        if (shards.empty()) return;
+        if (shards.size() == 1) {
+            fn(shards.front());
+            return;
+        }
+
+        auto call = std::make_shared<FanOut>();
+        call->fn = [&fn](size_t s) { fn(s); };
+        call->shards = shards;
+        call->remaining = shards.size();
+        if (!_workers.empty()) {
+            {
+                std::lock_guard<std::mutex> lock(_work_mutex);
+                for (size_t i = 0; i + 1 < shards.size(); ++i) _work.push_back(call);
+            }
+            _work_cv.notify_all();
+        }
+
+        run_parts(*call);
+        std::unique_lock<std::mutex> lock(call->mutex);
+        call->finished.wait(lock, [&] { return call->remaining == 0; });
+        if (call->error) std::rethrow_exception(call->error);
+    }
+
+    // Claim and run parts of call until none are left unclaimed
+    static void run_parts(FanOut& call) {
+        for (size_t i; (i = call.next++) < call.shards.size();) {
+            std::exception_ptr error;
+            try {
+                call.fn(call.shards[i]);
+            } catch (...) {
+                error = std::current_exception();
+            }
+            std::lock_guard<std::mutex> lock(call.mutex);
+            if (error && !call.error) call.error = error;
+            if (--call.remaining == 0) call.finished.notify_all();
+        }
+    }
+
+    void work_loop() {
+        while (true) {
+            std::shared_ptr<FanOut> call;
+            {
+                std::unique_lock<std::mutex> lock(_work_mutex);
+                _work_cv.wait(lock, [this] { return _stopping || !_work.empty(); });
+                if (_work.empty()) return; // Stopping
+                call = std::move(_work.front());
+                _work.pop_front();
+            }
+            run_parts(*call);
+        }
+    }
+};
@@ -0,0 +1,154 @@
+#pragma once
+
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+// One write inside StorageBackend::batch()
+struct WriteOp {
+    enum class Kind { Put, Delete };
+
+    Kind kind = Kind::Put;
+    std::string key;
+    std::string value; // Empty for deletes
+};
+
+// Thrown by StorageBackend::batch() when the store refuses the data itself
+// (e.g. bytes a text column cannot hold). Retrying the same ops can never
+// succeed, but the other ops of the batch may well succeed on their own.
+class RejectedWrite : public std::invalid_argument {
+public:
+    using std::invalid_argument::invalid_argument;
+
+    RejectedWrite(const std::string& what, std::vector<std::optional<bool>> applied)
+        : std::invalid_argument(what), _applied(std::move(applied)) {}
+
+    // Empty if the batch applied nothing. Otherwise one entry per op: its
+    // result if it was applied anyway (see ShardedBackend), else std::nullopt.
+    const std::vector<std::optional<bool>>& applied() const { return _applied; }
+
+private:
+    std::vector<std::optional<bool>> _applied;
+};
+
+// Forward-only walk over a key range in key order (see StorageBackend::scan),
+// fetched in batches (for exports). Not thread-safe; throws like StorageBackend.
+class StorageCursor {
+public:
+    virtual ~StorageCursor() = default;
+
+    // Up to max_rows further entries; empty once the range is exhausted
+    virtual std::vector<std::pair<std::string, std::string>> next(size_t max_rows) = 0;
+};
+
+// Persistent key-value store behind the cache.
+//
+// Implementations must be thread-safe. Every method throws (std::exception)
+// when the store cannot serve the request; "not found" is never an error.
+class StorageBackend {
+public:
+    using MultiGetCallback =
+        std::function<void(std::vector<std::optional<std::string>> values, std::exception_ptr error)>;
+
+    virtual ~StorageBackend() = default;
+
+    // Short name for logs, e.g. "postgres"
+    virtual std::string name() const = 0;
+
+    // Connect or recover on-disk state; throws if the store is unusable
+    virtual void open() = 0;
+
+    virtual std::optional<std::string> get(const std::string& key) = 0;
+
+    // One value (or std::nullopt) per key, in order; keys may repeat
+    virtual std::vector<std::optional<std::string>> multi_get(const std::vector<std::string>& keys) = 0;
+
+    // multi_get() with the result delivered to done, possibly from another
+    // thread. The default runs multi_get() on the calling thread.
+    virtual void multi_get_async(const std::vector<std::string>& keys, MultiGetCallback done) {
+        std::vector<std::optional<std::string>> values;
+        std::exception_ptr error;
+        try {
+            values = multi_get(keys);
+        } catch (...) {
+            error = std::current_exception();
+        }
+        done(std::move(values), error);
+    }
+
+    // Up to limit entries whose key starts with prefix and sorts after
+    // start_after (std::nullopt: from the first such key, the empty key
+    // included), in key order. Key order is byte order, as std::string
+    // compares (unsigned bytes, shorter prefix first), never a locale's
+    // collation: callers merge and page through results with std::string
+    // comparisons. On Postgres this means COLLATE "C".
+    virtual std::vector<std::pair<std::string, std::string>> scan(const std::string& prefix,
+                                                                  const std::optional<std::string>& start_after,
+                                                                  size_t limit) = 0;
+
+    // Every entry whose key starts with prefix. The default pages through
+    // scan() by key, so it needs no state in the store but is not a
+    // snapshot: rows written during the walk may or may not appear.
+    virtual std::unique_ptr<StorageCursor> open_cursor(const std::string& prefix);
+
+    // Apply the writes atomically and in order. Returns one flag per op: true
+    // for puts, and for deletes whether the key existed. With durable false
+    // the store may acknowledge before the writes reach stable storage.
+    // Throws RejectedWrite if some op can never be stored; nothing is applied,
+    // unless RejectedWrite::applied() lists ops that were. Only backends that
+    // split a batch across stores (ShardedBackend) do that.
+    virtual std::vector<bool> batch(const std::vector<WriteOp>& ops, bool durable) = 0;
+
+    // Store many rows in one durable, atomic step, for bulk imports. Later
+    // rows win over earlier ones with the same key. The default is a batch
+    // of puts; backends with a faster bulk path (e.g. COPY) override it.
+    virtual void bulk_put(const std::vector<std::pair<std::string, std::string>>& rows) {
+        std::vector<WriteOp> ops;
+        ops.reserve(rows.size());
+        for (const auto& row : rows) ops.push_back(WriteOp{WriteOp::Kind::Put, row.first, row.second});
+        batch(ops, true);
+    }
+
+    // Keys another writer just changed (e.g. another server instance).
+    // Backends that read from lagging replicas use this to read them from
+    // the primary for a while; the default ignores it.
+    virtual void note_external_writes(const std::vector<std::string>& /*keys*/) {}
+
+    void put(const std::string& key, const std::string& value, bool durable = true) {
+        batch({WriteOp{WriteOp::Kind::Put, key, value}}, durable);
+    }
+
+    bool remove(const std::string& key, bool durable = true) {
+        return batch({WriteOp{WriteOp::Kind::Delete, key, ""}}, durable).front();
+    }
+};
+
+// Keyset pagination over StorageBackend::scan()
+class ScanCursor : public StorageCursor {
+public:
+    ScanCursor(StorageBackend& backend, std::string prefix) : _backend(backend), _prefix(std::move(prefix)) {}
+
+    std::vector<std::pair<std::string, std::string>> next(size_t max_rows) override {
+        if (_done) return {};
+        auto entries = _backend.scan(_prefix, _after, max_rows);
+        if (entries.size() < max_rows) _done = true;
+        if (!entries.empty()) _after = entries.back().first;
+        return entries;
+    }
+
+private:
+    StorageBackend& _backend;
+    std::string _prefix;
+    std::optional<std::string> _after; // Last key returned
+    bool _done = false;
+};
+
+inline std::unique_ptr<StorageCursor> StorageBackend::open_cursor(const std::string& prefix) {
+    return std::make_unique<ScanCursor>(*this, prefix);
+}
@@ -0,0 +1,390 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <dirent.h>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include "crc32.h"
+#include "logger.h"
+
+struct WalRecord {
+    enum class Op : uint8_t { Put = 1, Delete = 2 };
+
+    uint64_t lsn = 0;
+    Op op = Op::Put;
+    std::string key;
+    std::string value; // Empty for deletes
+};
+
+// Append-only, segmented local write-ahead log with group fsync.
+//
+// Each record is [u32 payload length][u32 CRC32 of payload][payload], where
+// the payload is lsn (u64), op (u8), key length (u32), value length (u32),
+// key and value. append() returns once the record is on stable storage;
+// concurrent appenders share fdatasync calls (the first waiter syncs on
+// behalf of everyone who wrote before it). A failed write or fdatasync
+// leaves the file in an unknown state, so the log then refuses every
+// further append until it is reopened. Segments are named by their first
+// LSN and rotated at segment_bytes. checkpoint() durably records the
+// highest LSN applied downstream in a checkpoint file (so recover() skips
+// those records even in the segment still being written) and deletes
+// segments whose records have all been applied.
+class WriteAheadLog {
+public:
+    WriteAheadLog(const std::string& dir, size_t segment_bytes)
+        : _dir(dir), _segment_bytes(segment_bytes) {}
+
+    ~WriteAheadLog() {
+        if (_fd >= 0) {
+            fdatasync(_fd);
+            close(_fd);
+        }
+    }
+
+    WriteAheadLog(const WriteAheadLog&) = delete;
+    WriteAheadLog& operator=(const WriteAheadLog&) = delete;
+
+    // Whether the directory holds any segments, i.e. whether a log was used
+    // here before (and may still hold records to replay)
+    bool has_segments() const { return !list_segments().empty(); }
+
+    // Read every intact record not yet applied (past the checkpoint) from
+    // existing segments, in LSN order, drop a torn tail left by a crash, and
+    // open a fresh segment for new appends. Creates the directory (and its
+    // parents) if needed. Must be called once before append().
+    std::vector<WalRecord> recover() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        make_dirs(_dir);
+        _checkpoint_lsn = read_checkpoint();
+
+        std::vector<WalRecord> records;
+        uint64_t last_lsn = _checkpoint_lsn;
+        size_t skipped = 0;
+        for (const auto& segment : list_segments()) {
+            _segments.push_back(segment);
+            std::vector<WalRecord> segment_records;
+            read_segment(segment.second, segment_records);
+            for (auto& record : segment_records) {
+                last_lsn = std::max(last_lsn, record.lsn);
+                if (record.lsn <= _checkpoint_lsn) {
+                    ++skipped;
+                } else {
+                    records.push_back(std::move(record));
+                }
+            }
+        }
+        // LSNs keep growing past the checkpoint, or new records would be skipped next time
+        _next_lsn = last_lsn + 1;
+        if (!_segments.empty()) _next_lsn = std::max(_next_lsn, _segments.back().first);
+        _durable_lsn = _next_lsn - 1;
+        _delivered_lsn = _durable_lsn;
+        open_segment();
+        log_event("WAL: Recovered " + std::to_string(records.size()) + " record(s) from " + _dir + " (" +
+                  std::to_string(skipped) + " already applied, checkpoint LSN " + std::to_string(_checkpoint_lsn) + ")");
+        return records;
+    }
+
+    // Append a record and wait until it is durable. Returns its LSN; throws
+    // if the record could not be made durable. on_logged runs under the log's
+    // lock once the record is durable, in LSN order across appenders (it must
+    // not call back into the log), so a record is never handed on unless it
+    // will survive a crash.
+    uint64_t append(WalRecord::Op op, const std::string& key, const std::string& value,
+                    const std::function<void(uint64_t)>& on_logged = nullptr) {
+        std::unique_lock<std::mutex> lock(_mutex);
+        if (!_failure.empty()) throw std::runtime_error(_failure);
+        uint64_t lsn = _next_lsn++;
+        std::string frame = encode(lsn, op, key, value);
+        if (!write_all(_fd, frame.data(), frame.size())) {
+            fail("WAL write failed: " + std::string(std::strerror(errno)));
+            throw std::runtime_error(_failure);
+        }
+        _written_lsn = lsn;
+        _segment_size += frame.size();
+
+        // Group fsync: whoever finds no sync in progress syncs everything written so far
+        while (_durable_lsn < lsn) {
+            if (!_failure.empty()) throw std::runtime_error(_failure);
+            if (_syncing) {
+                _synced.wait(lock);
+                continue;
+            }
+            _syncing = true;
+            uint64_t target = _written_lsn;
+            int fd = _fd;
+            lock.unlock();
+            int rc = fdatasync(fd);
+            lock.lock();
+            _syncing = false;
+            if (rc != 0) {
+                fail("WAL fsync failed: " + std::string(std::strerror(errno)));
+                throw std::runtime_error(_failure);
+            }
+            _durable_lsn = std::max(_durable_lsn, target);
+            _synced.notify_all();
+        }
+
+        // Everything before this record is durable too, so its appender is
+        // about to take (or has taken) its turn
+        _synced.wait(lock, [&] { return _delivered_lsn + 1 == lsn; });
+        if (on_logged) on_logged(lsn);
+        _delivered_lsn = lsn;
+        _synced.notify_all();
+
+        if (_segment_size >= _segment_bytes && !_syncing && _failure.empty()) {
+            // Sync the tail of the old segment ourselves so no later group
+            // sync is left pointing at a closed file
+            if (_durable_lsn < _written_lsn) {
+                if (fdatasync(_fd) != 0) {
+                    fail("WAL fsync failed: " + std::string(std::strerror(errno)));
+                    return lsn; // This record was already durable
+                }
+                _durable_lsn = _written_lsn;
+                _synced.notify_all();
+            }
+            try {
+                rotate();
+            } catch (const std::exception& e) {
+                fail(e.what());
+            }
+        }
+        return lsn;
+    }
+
+    // Everything up to and including applied_lsn has been persisted
+    // downstream: record that durably, then delete segments that contain
+    // nothing newer. Throws if the checkpoint file cannot be written.
+    void checkpoint(uint64_t applied_lsn) {
+        {
+            std::lock_guard<std::mutex> lock(_checkpoint_mutex);
+            if (applied_lsn <= _checkpoint_lsn) return;
+            write_checkpoint(applied_lsn);
+            _checkpoint_lsn = applied_lsn;
+        }
+        std::lock_guard<std::mutex> lock(_mutex);
+        // A segment ends right before the next one starts; never delete the active one
+        while (_segments.size() > 1 && _segments[1].first <= applied_lsn + 1) {
+            unlink(_segments.front().second.c_str());
+            log_event("WAL: Checkpoint removed " + _segments.front().second);
+            _segments.erase(_segments.begin());
+        }
+    }
+
+    // Keep a record the downstream store refused for good in dead-letter.log
+    // (framed like the segments), so it can still be inspected or replayed
+    // by hand once checkpoints have moved past it. Throws on I/O errors.
+    void dead_letter(const WalRecord& record) {
+        std::lock_guard<std::mutex> lock(_checkpoint_mutex);
+        std::string path = _dir + "/dead-letter.log";
+        std::string frame = encode(record.lsn, record.op, record.key, record.value);
+        int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        bool ok = fd >= 0 && write_all(fd, frame.data(), frame.size()) && fdatasync(fd) == 0;
+        int error = errno;
+        if (fd >= 0) close(fd);
+        if (!ok) throw std::runtime_error("Cannot write WAL dead letter " + path + ": " + std::strerror(error));
+    }
+
+private:
+    std::string _dir;
+    size_t _segment_bytes;
+    std::vector<std::pair<uint64_t, std::string>> _segments; // {first LSN, path}, oldest first
+    int _fd = -1;
+    size_t _segment_size = 0;
+    uint64_t _next_lsn = 1;
+    uint64_t _written_lsn = 0;
+    uint64_t _durable_lsn = 0;
+    uint64_t _delivered_lsn = 0; // Last record handed to on_logged
+    bool _syncing = false;
+    std::string _failure; // Why appends are refused; empty while the log is healthy
+    std::mutex _mutex;
+    std::condition_variable _synced;
+    uint64_t _checkpoint_lsn = 0; // Highest LSN applied downstream, as on disk
+    std::mutex _checkpoint_mutex; // Serializes checkpoint and dead-letter writes without holding up appends
+
+    template <typename T>
+    static void put_int(std::string& out, T value) {
+        out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    template <typename T>
+    static T get_int(const char* data) {
+        T value;
+        std::memcpy(&value, data, sizeof(value));
+        return value;
+    }
+
+    static std::string encode(uint64_t lsn, WalRecord::Op op, const std::string& key, const std::string& value) {
+        std::string payload;
+        payload.reserve(17 + key.size() + value.size());
+        put_int<uint64_t>(payload, lsn);
+        put_int<uint8_t>(payload, static_cast<uint8_t>(op));
+        put_int<uint32_t>(payload, static_cast<uint32_t>(key.size()));
+        put_int<uint32_t>(payload, static_cast<uint32_t>(value.size()));
+        payload += key;
+        payload += value;
+
+        std::string frame;
+        frame.reserve(8 + payload.size());
+        put_int<uint32_t>(frame, static_cast<uint32_t>(payload.size()));
+        put_int<uint32_t>(frame, crc32(payload.data(), payload.size()));
+        frame += payload;
+        return frame;
+    }
+
+    static bool write_all(int fd, const char* data, size_t len) {
+        while (len > 0) {
+            ssize_t n = write(fd, data, len);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            data += n;
+            len -= static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    std::string segment_path(uint64_t first_lsn) const {
+        char name[32];
+        std::snprintf(name, sizeof(name), "wal-%020llu.log", static_cast<unsigned long long>(first_lsn));
+        return _dir + "/" + name;
+    }
+
+    // Called with the lock held. Records not yet durable may or may not
+    // have reached the disk, so their appenders and all later ones fail.
+    void fail(const std::string& error) {
+        _failure = error;
+        log_event("WAL: " + error + ", refusing further writes");
+        std::cerr << "WAL Error: " << error << std::endl;
+        _synced.notify_all();
+    }
+
+    std::string checkpoint_path() const { return _dir + "/checkpoint"; }
+
+    // The applied LSN from the checkpoint file, or 0 if there is none yet
+    uint64_t read_checkpoint() const {
+        FILE* file = std::fopen(checkpoint_path().c_str(), "r");
+        if (!file) return 0;
+        unsigned long long lsn = 0;
+        if (std::fscanf(file, "%llu", &lsn) != 1) lsn = 0;
+        std::fclose(file);
+        return lsn;
+    }
+
+    // Write the file next to the old one, sync it, and rename it over the old
+    // one, so a crash leaves either checkpoint intact
+    void write_checkpoint(uint64_t lsn) const {
+        std::string path = checkpoint_path();
+        std::string temp = path + ".tmp";
+        std::string data = std::to_string(lsn) + "\n";
+        int fd = open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        bool ok = fd >= 0 && write_all(fd, data.data(), data.size()) && fdatasync(fd) == 0;
+        int error = errno;
+        if (fd >= 0) close(fd);
+        if (!ok || rename(temp.c_str(), path.c_str()) != 0) {
+            if (ok) error = errno;
+            throw std::runtime_error("Cannot write WAL checkpoint " + path + ": " + std::strerror(error));
+        }
+        sync_dir();
+    }
+
+    static void make_dirs(const std::string& dir) {
+        for (size_t slash = dir.find('/', 1); ; slash = dir.find('/', slash + 1)) {
+            std::string path = dir.substr(0, slash);
+            if (mkdir(path.c_str(), 0755) != 0 && errno != EEXIST) {
+                throw std::runtime_error("Cannot create WAL directory " + path + ": " + std::strerror(errno));
+            }
+            if (slash == std::string::npos) return;
+        }
+    }
+
+    void sync_dir() const {
+        int dir_fd = open(_dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dir_fd >= 0) {
+            fsync(dir_fd);
+            close(dir_fd);
+        }
+    }
+
+    std::vector<std::pair<uint64_t, std::string>> list_segments() const {
+        std::vector<std::pair<uint64_t, std::string>> segments;
+        DIR* dir = opendir(_dir.c_str());
+        if (!dir) return segments;
+        while (dirent* entry = readdir(dir)) {
+            unsigned long long first_lsn;
+            if (std::sscanf(entry->d_name, "wal-%20llu.log", &first_lsn) == 1) {
+                segments.emplace_back(first_lsn, _dir + "/" + entry->d_name);
+            }
+        }
+        closedir(dir);
+        std::sort(segments.begin(), segments.end());
+        return segments;
+    }
+
+    // Parse records until the end of the file or the first torn/corrupt
+    // frame, then truncate the file there
+    static void read_segment(const std::string& path, std::vector<WalRecord>& records) {
+        int fd = open(path.c_str(), O_RDWR | O_CLOEXEC);
+        if (fd < 0) return;
+        std::string data;
+        char buf[65536];
+        ssize_t n;
+        while ((n = read(fd, buf, sizeof(buf))) > 0) data.append(buf, static_cast<size_t>(n));
+
+        size_t pos = 0;
+        while (pos + 8 <= data.size()) {
+            uint32_t len = get_int<uint32_t>(data.data() + pos);
+            uint32_t crc = get_int<uint32_t>(data.data() + pos + 4);
+            if (len < 17 || pos + 8 + len > data.size()) break;
+            const char* payload = data.data() + pos + 8;
+            if (crc32(payload, len) != crc) break;
+
+            WalRecord record;
+            record.lsn = get_int<uint64_t>(payload);
+            record.op = static_cast<WalRecord::Op>(get_int<uint8_t>(payload + 8));
+            uint32_t key_len = get_int<uint32_t>(payload + 9);
+            uint32_t value_len = get_int<uint32_t>(payload + 13);
+            if (17ull + key_len + value_len != len) break;
+            record.key.assign(payload + 17, key_len);
+            record.value.assign(payload + 17 + key_len, value_len);
+            records.push_back(std::move(record));
+            pos += 8 + len;
+        }
+        if (pos < data.size()) {
+            log_event("WAL: Truncating torn tail of " + path + " at offset " + std::to_string(pos));
+            if (ftruncate(fd, static_cast<off_t>(pos)) == 0) fdatasync(fd);
+        }
+        close(fd);
+    }
+
+    void open_segment() {
+        std::string path = segment_path(_next_lsn);
+        _fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (_fd < 0) {
+            throw std::runtime_error("Cannot open WAL segment " + path + ": " + std::strerror(errno));
+        }
+        _segment_size = 0;
+        if (_segments.empty() || _segments.back().second != path) _segments.emplace_back(_next_lsn, path);
+        // Make the new file's directory entry durable too
+        sync_dir();
+    }
+
+    // Called with the lock held once every record in the old segment is durable
+    void rotate() {
+        close(_fd);
+        open_segment();
+    }
+};
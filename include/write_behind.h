@@ -0,0 +1,221 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "logger.h"
+#include "write_ahead_log.h"
+
+// Write-behind persistence on top of a local WAL.
+//
+// put()/remove() return as soon as the record is durable in the WAL. A
+// background thread drains logged records to the backing store in LSN order,
+// in batches, via the apply function, retrying a failed batch until it
+// succeeds. A batch the store rejects outright (bad data, not a transient
+// error) is applied again one record at a time, and a single rejected
+// record is moved to the WAL's dead-letter file and skipped, so one bad
+// record cannot stall everything behind it; wait_applied() reports it as
+// rejected rather than applied. Applied batches then checkpoint
+// the WAL (records the applied LSN, so a
+// restart does not apply the same records again). Until a record is
+// applied, its latest state per key is kept in an overlay so reads never
+// see an older value from the backing store.
+class WriteBehindQueue {
+public:
+    enum class ApplyResult {
+        Applied,
+        Failed,  // Transient (e.g. the store is unreachable): retried as is
+        Rejected // The store refused the data itself: retrying cannot help
+    };
+    using ApplyFn = std::function<ApplyResult(const std::vector<WalRecord>&)>;
+
+    // Outcome of wait_applied()
+    enum class WaitResult {
+        Applied,
+        Rejected, // Dead-lettered: the store never took it
+        TimedOut
+    };
+
+    WriteBehindQueue(WriteAheadLog& wal, ApplyFn apply, size_t batch_size, size_t max_pending,
+                     std::chrono::milliseconds retry_delay)
+        : _wal(wal), _apply(std::move(apply)), _batch_size(batch_size), _max_pending(max_pending),
+          _retry_delay(retry_delay) {}
+
+    ~WriteBehindQueue() {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stopping = true;
+        }
+        _cv.notify_all();
+        if (_drainer.joinable()) _drainer.join();
+    }
+
+    WriteBehindQueue(const WriteBehindQueue&) = delete;
+    WriteBehindQueue& operator=(const WriteBehindQueue&) = delete;
+
+    // Queue records recovered from the WAL and start draining
+    void start(std::vector<WalRecord> recovered) {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            for (auto& record : recovered) track(std::move(record));
+        }
+        _drainer = std::thread([this] { drain_loop(); });
+    }
+
+    // Durably log a write and return its LSN. Returns std::nullopt if too
+    // many writes are still waiting for the backing store; throws if the WAL
+    // cannot be written.
+    std::optional<uint64_t> put(const std::string& key, const std::string& value) {
+        return log(WalRecord::Op::Put, key, value);
+    }
+
+    std::optional<uint64_t> remove(const std::string& key) {
+        return log(WalRecord::Op::Delete, key, "");
+    }
+
+    // Block until the record with this LSN has been drained: applied to the
+    // backing store, or rejected by it. Only the last kMaxRejected rejections
+    // are remembered, so wait soon after logging.
+    WaitResult wait_applied(uint64_t lsn, std::chrono::milliseconds timeout) {
+        std::unique_lock<std::mutex> lock(_mutex);
+        if (!_applied_cv.wait_for(lock, timeout, [&] { return _applied_lsn >= lsn; })) return WaitResult::TimedOut;
+        return _rejected.count(lsn) ? WaitResult::Rejected : WaitResult::Applied;
+    }
+
+    // State of a key that has not reached the backing store yet:
+    // std::nullopt if nothing is pending, an empty optional for a pending delete
+    std::optional<std::optional<std::string>> pending(const std::string& key) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto it = _overlay.find(key);
+        if (it == _overlay.end()) return std::nullopt;
+        return it->second.value;
+    }
+
+    // Logged records not yet applied
+    size_t backlog() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _queue.size();
+    }
+
+private:
+    struct Latest {
+        uint64_t lsn;
+        std::optional<std::string> value; // std::nullopt for a delete
+    };
+
+    WriteAheadLog& _wal;
+    ApplyFn _apply;
+    size_t _batch_size;
+    size_t _max_pending;
+    std::chrono::milliseconds _retry_delay;
+    std::deque<WalRecord> _queue; // LSN order
+    std::unordered_map<std::string, Latest> _overlay;
+    uint64_t _applied_lsn = 0;
+    static constexpr size_t kMaxRejected = 1024;
+    std::set<uint64_t> _rejected; // Dead-lettered LSNs, newest kMaxRejected
+    bool _stopping = false;
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    std::condition_variable _applied_cv;
+    std::thread _drainer;
+
+    // Called with _mutex held
+    void track(WalRecord record) {
+        Latest latest{record.lsn, std::nullopt};
+        if (record.op == WalRecord::Op::Put) latest.value = record.value;
+        _overlay[record.key] = std::move(latest);
+        _queue.push_back(std::move(record));
+    }
+
+    std::optional<uint64_t> log(WalRecord::Op op, const std::string& key, const std::string& value) {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (_queue.size() >= _max_pending) return std::nullopt;
+        }
+        // Registered under the WAL lock once durable, so the queue stays in
+        // LSN order and never holds a write a crash could lose
+        return _wal.append(op, key, value, [&](uint64_t lsn) {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                track(WalRecord{lsn, op, key, value});
+            }
+            _cv.notify_one();
+        });
+    }
+
+    // The store refused this record for good: keep it aside and move past it
+    void dead_letter(const WalRecord& record) {
+        std::cerr << "WAL Apply Error: record " << record.lsn << " for key '" << record.key << "' rejected" << std::endl;
+        log_event("WRITE-BEHIND: Record " + std::to_string(record.lsn) + " for key '" + record.key +
+                  "' rejected by the store, moving it to the dead-letter file");
+        try {
+            _wal.dead_letter(record);
+        } catch (const std::exception& e) {
+            std::cerr << "WAL Dead Letter Error: " << e.what() << std::endl;
+            log_event(std::string("WRITE-BEHIND: Could not keep the rejected record: ") + e.what());
+        }
+    }
+
+    void drain_loop() {
+        size_t isolate = 0; // Records still to apply one at a time after a rejected batch
+        while (true) {
+            std::vector<WalRecord> batch;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _cv.wait(lock, [this] { return _stopping || !_queue.empty(); });
+                if (_stopping) return; // Anything left is still in the WAL for next startup
+                size_t count = std::min(_queue.size(), isolate > 0 ? 1 : _batch_size);
+                batch.assign(_queue.begin(), _queue.begin() + count);
+            }
+
+            ApplyResult result = _apply(batch);
+            if (result == ApplyResult::Failed) {
+                log_event("WRITE-BEHIND: Applying " + std::to_string(batch.size()) + " record(s) failed, retrying");
+                std::unique_lock<std::mutex> lock(_mutex);
+                _cv.wait_for(lock, _retry_delay, [this] { return _stopping; });
+                continue;
+            }
+            if (result == ApplyResult::Rejected && batch.size() > 1) {
+                log_event("WRITE-BEHIND: Batch of " + std::to_string(batch.size()) + " record(s) rejected, applying them one at a time");
+                isolate = batch.size();
+                continue;
+            }
+            if (result == ApplyResult::Rejected) dead_letter(batch.front());
+            if (isolate > 0) --isolate;
+
+            uint64_t applied_lsn = batch.back().lsn;
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                // New records only ever go to the back, so the batch is still the prefix
+                _queue.erase(_queue.begin(), _queue.begin() + batch.size());
+                if (result == ApplyResult::Rejected) {
+                    _rejected.insert(batch.front().lsn);
+                    if (_rejected.size() > kMaxRejected) _rejected.erase(_rejected.begin());
+                }
+                for (const auto& record : batch) {
+                    auto it = _overlay.find(record.key);
+                    if (it != _overlay.end() && it->second.lsn <= applied_lsn) _overlay.erase(it);
+                }
+                _applied_lsn = applied_lsn;
+            }
+            _applied_cv.notify_all();
+            try {
+                _wal.checkpoint(applied_lsn);
+            } catch (const std::exception& e) {
+                // Records stay past the checkpoint and are applied again after a restart
+                std::cerr << "WAL Checkpoint Error: " << e.what() << std::endl;
+                log_event(std::string("WRITE-BEHIND: Checkpoint failed: ") + e.what());
+            }
+        }
+    }
+};
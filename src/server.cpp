@@ -1,128 +1,863 @@
 #include "../include/httplib.h"
 #include "../include/lru_cache.h"
-#include <pqxx/pqxx>
 #include <thread>
 #include <optional>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
 #include "../include/json.hpp"
 #include "../include/logger.h"
+#include "../include/memory_monitor.h"
+#include "../include/mrc_profiler.h"
+#include "../include/batcher.h"
+#include "../include/postgres_backend.h"
+#include "../include/bitcask_backend.h"
+#include "../include/mock_backend.h"
+#include "../include/sharded_backend.h"
+#include "../include/concurrency_limiter.h"
+#include "../include/write_behind.h"
+#include "../include/invalidation_listener.h"
+#include "../include/import_reader.h"
+#include "../include/event_server.h"
+#include <unordered_map>
+#include <future>
+#include <type_traits>
+#include <map>
+#include <unordered_set>
+#include <atomic>
+#include <algorithm>
+#include <memory>
+#include <cstdlib>
+#include <random>
+#include <sstream>
+#include <unistd.h>
+
+// Durability levels a write can request with the X-KV-Durability header
+enum class Durability {
+    Sync,      // "sync": on stable storage in the backend before the response
+    Async,     // "async": backend may acknowledge first (Postgres: synchronous_commit = off)
+    CacheOnly  // "cache-only": write-behind, acknowledged once in the local WAL
+};
 
 // --- Configuration ---
 const int SERVER_PORT = 8080;
-const int CACHE_CAPACITY = 100; // Max items in cache
+const int CACHE_CAPACITY = 100; // Initial max items in cache (resizable via /admin/cache/capacity)
+const EvictionPolicy CACHE_EVICTION_POLICY = EvictionPolicy::LRU; // SLRU resists one-off scans (e.g. exports)
+const double CACHE_PROTECTED_RATIO = 0.8; // SLRU: share of capacity for entries hit more than once
+const int CACHE_TTL_MS = 0; // How long a cached value is fresh; 0 = never expires
+const int CACHE_STALE_WHILE_REVALIDATE_MS = 30000; // After the TTL: served at once while one background read refreshes it
+const int CACHE_STALE_IF_ERROR_MS = 300000; // After that: served only if the backend read fails or is shed
+const double CACHE_REFRESH_AHEAD_FRACTION = 0.2; // Reload hot entries hit in this last share of their TTL; 0 = off
+const uint32_t CACHE_REFRESH_AHEAD_MIN_HITS = 2; // Hits since the value was stored that make an entry hot
+const size_t CACHE_MAX_CAPACITY = 10000000; // Upper bound accepted by the resize endpoint
+const size_t CACHE_TRIM_BATCH = 256; // Evictions per lock hold when shrinking
+const int CACHE_TRIM_PAUSE_MS = 1; // Pause between trim batches so requests can interleave
+const bool MEMORY_AUTOSCALE_ENABLED = true; // Shrink/grow the cache with cgroup memory pressure
+const int MEMORY_POLL_INTERVAL_MS = 1000;
+const size_t CACHE_MIN_CAPACITY = 16; // Never auto-shrink below this
+const double MEMORY_HIGH_WATERMARK = 0.90; // memory.current / memory.max that triggers a shrink
+const double MEMORY_LOW_WATERMARK = 0.75; // Below this (and low PSI) the cache may grow back
+const double PSI_HIGH_AVG10 = 10.0; // memory.pressure "some avg10" (%) that triggers a shrink
+const double PSI_LOW_AVG10 = 1.0;
+const double CACHE_SHRINK_FACTOR = 0.8; // Capacity multiplier per shrink step
+const double CACHE_GROW_FACTOR = 1.1; // Capacity multiplier per grow step
+const double MRC_SAMPLING_RATE = 0.01; // Initial SHARDS key sampling rate
+const size_t MRC_MAX_SAMPLED_KEYS = 8192; // Ghost keys tracked; the rate drops to stay under this
+const size_t MRC_BUCKET_SIZE = 10; // Reuse-distance histogram granularity (entries)
+const size_t MRC_BUCKET_COUNT = 100000; // Histogram covers sizes up to MRC_BUCKET_SIZE * MRC_BUCKET_COUNT
 // Use std::thread::hardware_concurrency() or a fixed number
 const int SERVER_THREAD_COUNT = 16; 
+// "epoll": a few I/O threads multiplex all connections, handlers run on SERVER_THREAD_COUNT workers.
+// "httplib": one of SERVER_THREAD_COUNT threads per open connection. Env KV_FRONT_END overrides.
+const std::string FRONT_END = "epoll";
+const size_t EVENT_IO_THREADS = 2; // epoll front end: threads reading and writing sockets
+const size_t EVENT_MAX_CONNECTIONS = 10000; // Per I/O thread
+const int EVENT_IDLE_TIMEOUT_MS = 60000; // Close keep-alive connections idle this long
+const size_t EVENT_MAX_BODY_BYTES = 1024 * 1024; // Buffered request bodies (413 beyond this); imports stream theirs
+const std::string STORAGE_BACKEND = "postgres"; // "postgres", "bitcask" (embedded, no DB server) or "mock"; env KV_STORAGE_BACKEND overrides
+const std::string BITCASK_DIR = "data";
+const size_t BITCASK_MAX_FILE_BYTES = 64 * 1024 * 1024; // Data file size before rotating
+const double BITCASK_COMPACTION_RATIO = 0.5; // Compact once this share of stored bytes is garbage
+const int BITCASK_COMPACTION_INTERVAL_MS = 10000; // How often to check whether to compact
+const size_t MOCK_SHARDS = 64; // Mock backend: lock-striped in-memory maps
+// Mock backend latency per operation (ms): none | fixed:<ms> | uniform:<min>:<max> |
+// lognormal:<median>:<sigma>, plus optional ,spike:<probability>:<ms>. Env KV_MOCK_*_LATENCY overrides.
+const std::string MOCK_READ_LATENCY = "lognormal:0.5:0.4";
+const std::string MOCK_WRITE_LATENCY = "lognormal:1:0.5,spike:0.001:50";
+const std::string MOCK_SCAN_LATENCY = "lognormal:2:0.5";
+const uint64_t MOCK_LATENCY_SEED = 42;
 const std::string DB_CONNECTION_STRING = "dbname=kv_system user=kv_user password=password host=localhost sslmode=require";
+// Hash-partition kv_store across several databases, as {name, connection string}; empty = DB_CONNECTION_STRING
+// alone. Names decide key placement: keep them when connection strings change, and append new shards to scale out.
+const std::vector<std::pair<std::string, std::string>> DB_SHARDS = {};
+const size_t DB_SHARD_VIRTUAL_NODES = 128; // Consistent-hash ring points per shard
+// Read-only replicas for cache-miss reads, keyed by shard name ("default" without DB_SHARDS)
+const std::map<std::string, std::vector<std::string>> DB_REPLICAS = {};
+const int DB_READ_YOUR_WRITES_MS = 5000; // Read a key from the primary this long after it was written (> replica lag)
+const size_t DB_POOL_SIZE = SERVER_THREAD_COUNT; // Max concurrent Postgres connections (per shard)
+const int DB_POOL_WAIT_TIMEOUT_MS = 2000; // Fail a request if no connection frees up in time
+const int DB_POOL_HEALTH_CHECK_IDLE_MS = 30000; // Ping connections idle longer than this before reuse
+const std::string INVALIDATION_CHANNEL = "kv_invalidate"; // NOTIFY channel shared by all instances; "" = single instance
+const int INVALIDATION_BATCH_WINDOW_MS = 5; // Notifications collected before dropping their keys from the cache
+const int WRITE_BATCH_WINDOW_US = 1000; // How long concurrent POSTs may wait to share one commit
+const size_t WRITE_BATCH_MAX_ITEMS = 256; // Flush early once this many upserts are queued
+const size_t WRITE_BATCH_FLUSHERS = 4; // Batches committing in parallel (each holds a pooled connection)
+const bool DB_BINARY_VALUES = false; // kv_store.value is BYTEA; values travel in libpq binary format
+const size_t DB_ASYNC_CONNECTIONS = 4; // Non-blocking connections multiplexed by the async executor (cache-miss reads, per shard)
+const int DB_ASYNC_QUERY_TIMEOUT_MS = 5000; // Fail an async query (or connection attempt) and reconnect after this long
+const int READ_BATCH_WINDOW_US = 500; // How long concurrent cache misses may wait to share one SELECT
+const size_t READ_BATCH_MAX_ITEMS = 256;
+const size_t READ_BATCH_FLUSHERS = 4;
+const double DB_LIMIT_INITIAL = SERVER_THREAD_COUNT / 2; // Adaptive cap on requests waiting on the backend; grows while latency holds
+const double DB_LIMIT_MIN = 2;
+// Ceiling on that cap. Under httplib every request waiting on the backend holds a server thread, so it stops at
+// three quarters of them and cache hits always find one free. Under epoll no thread waits (key requests finish
+// from completion callbacks), so it is what the backend can take at once: a full read batch per async connection.
+const double DB_LIMIT_MAX_HTTPLIB = SERVER_THREAD_COUNT * 3 / 4;
+const double DB_LIMIT_MAX_EPOLL = DB_ASYNC_CONNECTIONS * READ_BATCH_MAX_ITEMS; // Per shard
+const double DB_LIMIT_TOLERANCE = 2.0; // Shrink once recent latency exceeds this multiple of the baseline
+const int DELETE_BATCH_WINDOW_US = 500; // How long concurrent DELETEs may wait to share one batch
+const size_t DELETE_BATCH_MAX_ITEMS = 128;
+const size_t DELETE_BATCH_FLUSHERS = 2;
+const Durability DEFAULT_DURABILITY = Durability::Sync; // For writes without an X-KV-Durability header
+const bool WRITE_BEHIND_ENABLED = false; // Accept X-KV-Durability: cache-only (env KV_WRITE_BEHIND=on|off)
+const std::string WAL_DIR = "/var/lib/kv-cache/wal"; // Write-behind log (env KV_WAL_DIR); replayed on startup if present
+const size_t WAL_SEGMENT_BYTES = 64 * 1024 * 1024;
+const size_t WRITE_BEHIND_BATCH = 1000; // WAL records applied per Postgres transaction
+const size_t WRITE_BEHIND_MAX_PENDING = 100000; // Reject writes once this many are waiting for Postgres
+const int WRITE_BEHIND_RETRY_MS = 1000; // Delay before retrying a failed apply
+const int WRITE_BEHIND_SYNC_WAIT_MS = 5000; // Max wait for a sync write queued behind pending WAL writes
+const size_t IMPORT_BATCH_ROWS = 50000; // Rows per COPY + merge transaction in POST /kv/import
+const size_t SCAN_DEFAULT_LIMIT = 100; // GET /kv page size without ?limit
+const size_t SCAN_MAX_LIMIT = 1000;
+const size_t EXPORT_FETCH_ROWS = 1000; // Rows per cursor FETCH (and per response chunk) in GET /admin/export
+const int EXPORT_MAX_CONCURRENT = 2; // Each running export holds a server thread and a pooled connection
 // ---------------------
 
 using json = nlohmann::json;
 
 // Global cache instance
-LRUCache cache(CACHE_CAPACITY);
+LRUCache cache(CACHE_CAPACITY, CACHE_EVICTION_POLICY, CACHE_PROTECTED_RATIO,
+               CacheExpiry{std::chrono::milliseconds(CACHE_TTL_MS),
+                           std::chrono::milliseconds(CACHE_STALE_WHILE_REVALIDATE_MS),
+                           std::chrono::milliseconds(CACHE_STALE_IF_ERROR_MS),
+                           CACHE_REFRESH_AHEAD_FRACTION, CACHE_REFRESH_AHEAD_MIN_HITS});
+
+// Sampled reuse-distance profile of the request stream (hit ratio vs cache size)
+MRCProfiler mrc_profiler(MRC_SAMPLING_RATE, MRC_MAX_SAMPLED_KEYS, MRC_BUCKET_SIZE, MRC_BUCKET_COUNT);
+
+// --- Cache Resizing ---
+
+// Shrinking the cache only lowers its capacity; the excess entries are
+// evicted here in small batches so no request waits behind a long eviction.
+std::mutex trim_mutex;
+std::condition_variable trim_cv;
+bool trim_requested = false;
+
+void cache_trimmer_loop() {
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(trim_mutex);
+            trim_cv.wait(lock, [] { return trim_requested; });
+            trim_requested = false;
+        }
+        size_t batches = 0;
+        size_t remaining;
+        do {
+            ++batches;
+            remaining = cache.trim(CACHE_TRIM_BATCH);
+            if (remaining > 0) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(CACHE_TRIM_PAUSE_MS));
+            }
+        } while (remaining > 0);
+        log_event("CACHE: Trim finished after " + std::to_string(batches) + " batch(es), size now " + std::to_string(cache.size()));
+    }
+}
+
+// Largest capacity the cache may have: set by the admin API, while the memory
+// autoscaler moves the effective capacity between CACHE_MIN_CAPACITY and this.
+std::atomic<size_t> cache_capacity_ceiling{CACHE_CAPACITY};
+
+void set_cache_capacity(size_t capacity) {
+    size_t old_capacity = cache.capacity();
+    if (capacity == old_capacity) return;
+    cache.set_capacity(capacity);
+    log_event("CACHE: Capacity changed from " + std::to_string(old_capacity) + " to " + std::to_string(capacity));
+    if (capacity < old_capacity) {
+        std::lock_guard<std::mutex> lock(trim_mutex);
+        trim_requested = true;
+        trim_cv.notify_one();
+    }
+}
+
+void resize_cache(size_t capacity) {
+    cache_capacity_ceiling = capacity;
+    set_cache_capacity(capacity);
+}
+
+// --- Memory Pressure Autoscaling ---
+
+// Shrinks the cache while the cgroup is close to its memory limit or stalling
+// on memory (PSI), and grows it back towards the ceiling once pressure subsides.
+void memory_autoscaler_loop(MemoryMonitor monitor) {
+    while (true) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(MEMORY_POLL_INTERVAL_MS));
+        auto sample = monitor.sample();
+        if (!sample) continue;
+
+        double usage = sample->usage_ratio();
+        double psi = sample->psi_some_avg10.value_or(0.0);
+        size_t capacity = cache.capacity();
+        size_t ceiling = cache_capacity_ceiling;
+
+        if (usage >= MEMORY_HIGH_WATERMARK || psi >= PSI_HIGH_AVG10) {
+            size_t target = std::max(CACHE_MIN_CAPACITY, static_cast<size_t>(capacity * CACHE_SHRINK_FACTOR));
+            if (target < capacity) {
+                log_event("MEMORY: Pressure (usage " + std::to_string(usage) + ", psi avg10 " + std::to_string(psi) + "), shrinking cache");
+                set_cache_capacity(target);
+            }
+        } else if (usage < MEMORY_LOW_WATERMARK && psi < PSI_LOW_AVG10 && capacity < ceiling) {
+            size_t target = std::min(ceiling, static_cast<size_t>(capacity * CACHE_GROW_FACTOR) + 1);
+            log_event("MEMORY: Pressure subsided (usage " + std::to_string(usage) + ", psi avg10 " + std::to_string(psi) + "), growing cache");
+            set_cache_capacity(target);
+        }
+    }
+}
 
 // --- Database Operations ---
 
-// Helper function to create a new DB connection
-pqxx::connection create_db_connection() {
-    log_event("Creating new database connection");
-    return pqxx::connection(DB_CONNECTION_STRING);
+// Startup override from the environment, for settings benchmarks flip between runs
+std::string env_or(const char* name, const std::string& fallback) {
+    const char* value = std::getenv(name);
+    return value && *value ? value : fallback;
+}
+
+// Tags this process's invalidation notifications: host, pid and a random suffix
+std::string make_instance_id() {
+    char host[256] = {};
+    gethostname(host, sizeof(host) - 1);
+    std::ostringstream id;
+    id << host << '-' << getpid() << '-' << std::hex << std::random_device{}();
+    return id.str();
+}
+
+const std::string instance_id = make_instance_id();
+
+// Throws std::invalid_argument for an unknown backend or a bad latency spec
+std::unique_ptr<StorageBackend> make_storage_backend() {
+    std::string backend = env_or("KV_STORAGE_BACKEND", STORAGE_BACKEND);
+    if (backend == "mock") {
+        MockBackend::Options options;
+        options.shards = MOCK_SHARDS;
+        options.read_latency = LatencyModel::parse(env_or("KV_MOCK_READ_LATENCY", MOCK_READ_LATENCY));
+        options.write_latency = LatencyModel::parse(env_or("KV_MOCK_WRITE_LATENCY", MOCK_WRITE_LATENCY));
+        options.scan_latency = LatencyModel::parse(env_or("KV_MOCK_SCAN_LATENCY", MOCK_SCAN_LATENCY));
+        options.seed = MOCK_LATENCY_SEED;
+        return std::make_unique<MockBackend>(options);
+    }
+    if (backend == "bitcask") {
+        return std::make_unique<BitcaskBackend>(BITCASK_DIR, BITCASK_MAX_FILE_BYTES, BITCASK_COMPACTION_RATIO,
+                                                std::chrono::milliseconds(BITCASK_COMPACTION_INTERVAL_MS));
+    }
+    if (backend != "postgres") throw std::invalid_argument("Unknown storage backend: " + backend);
+
+    auto postgres = [](const std::string& name, const std::string& connection_string) {
+        PostgresBackend::Options options;
+        options.connection_string = connection_string;
+        auto replicas = DB_REPLICAS.find(name);
+        if (replicas != DB_REPLICAS.end()) options.replicas = replicas->second;
+        options.read_your_writes_window = std::chrono::milliseconds(DB_READ_YOUR_WRITES_MS);
+        options.pool_size = DB_POOL_SIZE;
+        options.pool_wait_timeout = std::chrono::milliseconds(DB_POOL_WAIT_TIMEOUT_MS);
+        options.health_check_idle = std::chrono::milliseconds(DB_POOL_HEALTH_CHECK_IDLE_MS);
+        options.async_connections = DB_ASYNC_CONNECTIONS;
+        options.async_query_timeout = std::chrono::milliseconds(DB_ASYNC_QUERY_TIMEOUT_MS);
+        options.binary_values = DB_BINARY_VALUES;
+        options.notify_channel = INVALIDATION_CHANNEL;
+        options.instance_id = instance_id;
+        return std::make_unique<PostgresBackend>(options);
+    };
+    if (DB_SHARDS.empty()) return postgres("default", DB_CONNECTION_STRING);
+
+    std::vector<ShardedBackend::Shard> shards;
+    for (const auto& shard : DB_SHARDS) shards.push_back({shard.first, postgres(shard.first, shard.second)});
+    return std::make_unique<ShardedBackend>(std::move(shards), DB_SHARD_VIRTUAL_NODES);
+}
+
+// Persistent store behind the cache; every db_* operation below goes through
+// it. Created in main() before anything can use it.
+std::unique_ptr<StorageBackend> storage;
+
+// Runs ops as one backend batch. If the backend rejects the data of some op,
+// the batch is retried in halves, so only the requests it can never store fail
+// (std::nullopt) instead of every request that shared their transaction. Ops a
+// sharded backend applied despite the rejection keep their results and are not
+// run again. Other errors (e.g. the database is down) propagate and fail the
+// whole batch.
+std::vector<std::optional<bool>> db_batch_isolating(const std::vector<WriteOp>& ops, bool durable) {
+    try {
+        auto results = storage->batch(ops, durable);
+        return std::vector<std::optional<bool>>(results.begin(), results.end());
+    } catch (const RejectedWrite& e) {
+        if (!e.applied().empty()) {
+            std::vector<std::optional<bool>> results = e.applied();
+            std::vector<WriteOp> rest;
+            std::vector<size_t> positions;
+            for (size_t i = 0; i < ops.size(); ++i) {
+                if (results[i]) continue;
+                rest.push_back(ops[i]);
+                positions.push_back(i);
+            }
+            log_event("DB WRITE: Backend applied " + std::to_string(ops.size() - rest.size()) + " of " +
+                      std::to_string(ops.size()) + " write(s) and rejected the rest, retrying those");
+            auto retried = db_batch_isolating(rest, durable);
+            for (size_t i = 0; i < positions.size(); ++i) results[positions[i]] = retried[i];
+            return results;
+        }
+        if (ops.size() == 1) {
+            std::cerr << "DB Write Rejected: " << e.what() << std::endl;
+            log_event("DB WRITE: Backend rejected the write of key '" + ops.front().key + "'");
+            return {std::nullopt};
+        }
+        log_event("DB WRITE: Backend rejected a batch of " + std::to_string(ops.size()) + " write(s), retrying in halves");
+        size_t half = ops.size() / 2;
+        auto results = db_batch_isolating(std::vector<WriteOp>(ops.begin(), ops.begin() + half), durable);
+        auto rest = db_batch_isolating(std::vector<WriteOp>(ops.begin() + half, ops.end()), durable);
+        results.insert(results.end(), rest.begin(), rest.end());
+        return results;
+    }
 }
 
-// CREATE operation
-bool db_create(const std::string& key, const std::string& value) {
-    log_event("DB CREATE: Attempting to insert/update key '" + key + "' with value length " + std::to_string(value.length()));
+// Batched CREATE: upserts every (key, value) in one backend batch (one
+// transaction on Postgres). A non-durable batch may be acknowledged before it
+// reaches stable storage.
+std::vector<bool> db_create_batch(const std::vector<std::pair<std::string, std::string>>& items,
+                                  bool durable) {
+    std::vector<WriteOp> ops;
+    ops.reserve(items.size());
+    for (const auto& item : items) ops.push_back(WriteOp{WriteOp::Kind::Put, item.first, item.second});
+
+    log_event("DB CREATE: Committing batch of " + std::to_string(items.size()) + " request(s)" + (durable ? "" : " without waiting for durability"));
     try {
-        pqxx::connection conn = create_db_connection();
-        pqxx::work txn(conn);
-        
-        txn.exec(
-            "INSERT INTO kv_store (key, value) VALUES ($1, $2) "
-            "ON CONFLICT (key) DO UPDATE SET value = $2", pqxx::params{key,value});
-            
-        txn.commit();
-        log_event("DB CREATE: Successfully committed key '" + key + "'");
-        return true;
+        auto stored = db_batch_isolating(ops, durable);
+        std::vector<bool> results;
+        results.reserve(stored.size());
+        for (const auto& result : stored) results.push_back(result.value_or(false));
+        log_event("DB CREATE: Committed batch of " + std::to_string(items.size()) + " request(s)");
+        return results;
     } catch (const std::exception& e) {
         std::cerr << "DB Create Error: " << e.what() << std::endl;
-        log_event("DB CREATE: Failed for key '" + key + "' due to exception");
-        return false;
+        log_event("DB CREATE: Batch of " + std::to_string(items.size()) + " request(s) failed due to exception");
+        return std::vector<bool>(items.size(), false);
     }
 }
 
-// READ operation
-std::optional<std::string> db_read(const std::string& key) {
-    log_event("DB READ: Fetching key '" + key + "' from database");
+// Group commit: concurrent POSTs share a transaction instead of paying one commit (fsync) each.
+// Sync and async durability writes are batched separately since the setting is per transaction.
+using UpsertBatcher = Batcher<std::pair<std::string, std::string>, bool>;
+UpsertBatcher write_batcher(
+    "upsert", UpsertBatcher::FlushFn([](const auto& items) { return db_create_batch(items, true); }),
+    std::chrono::microseconds(WRITE_BATCH_WINDOW_US), WRITE_BATCH_MAX_ITEMS, WRITE_BATCH_FLUSHERS);
+UpsertBatcher async_write_batcher(
+    "upsert-async", UpsertBatcher::FlushFn([](const auto& items) { return db_create_batch(items, false); }),
+    std::chrono::microseconds(WRITE_BATCH_WINDOW_US), WRITE_BATCH_MAX_ITEMS, WRITE_BATCH_FLUSHERS);
+
+// Batched READ: resolves every cache miss in the batch with one backend
+// multi-get. The flusher hands it to the backend and moves straight on to the
+// next batch when the backend answers asynchronously (Postgres runs cache-miss
+// reads on non-blocking connections driven by one epoll loop).
+// A failed batch completes with std::nullopt (Batcher's Result{}) for every
+// key; a key that does not exist gets an empty optional.
+using ReadResult = std::optional<std::optional<std::string>>;
+
+void db_read_batch(const std::vector<std::string>& keys, std::function<void(std::vector<ReadResult>)> done) {
+    log_event("DB READ: Fetching batch of " + std::to_string(keys.size()) + " request(s)");
+    storage->multi_get_async(keys,
+        [count = keys.size(), done](std::vector<std::optional<std::string>> values, std::exception_ptr error) {
+            if (error) {
+                try {
+                    std::rethrow_exception(error);
+                } catch (const std::exception& e) {
+                    std::cerr << "DB Read Error: " << e.what() << std::endl;
+                    log_event("DB READ: Batch of " + std::to_string(count) + " request(s) failed: " + e.what());
+                }
+                done(std::vector<ReadResult>(count));
+                return;
+            }
+            std::vector<ReadResult> results(values.size());
+            for (size_t i = 0; i < values.size(); ++i) results[i] = std::move(values[i]);
+            done(std::move(results));
+        });
+}
+
+// Concurrent cache misses across different keys share one round trip
+Batcher<std::string, ReadResult> read_batcher(
+    "select", db_read_batch, std::chrono::microseconds(READ_BATCH_WINDOW_US),
+    READ_BATCH_MAX_ITEMS, READ_BATCH_FLUSHERS);
+
+// --- Write-Behind ---
+
+// Applies a batch of WAL records as one backend batch. Only the last record
+// per key matters, so the batch collapses to one write per key. Data the
+// backend refuses (RejectedWrite) is reported as Rejected, so the queue can
+// single out the bad record instead of retrying the batch forever.
+WriteBehindQueue::ApplyResult db_apply_wal_batch(const std::vector<WalRecord>& records) {
+    std::unordered_map<std::string, const WalRecord*> last;
+    for (const auto& record : records) last[record.key] = &record;
+
+    std::vector<WriteOp> ops;
+    ops.reserve(last.size());
+    size_t puts = 0;
+    for (const auto& entry : last) {
+        if (entry.second->op == WalRecord::Op::Put) {
+            ops.push_back(WriteOp{WriteOp::Kind::Put, entry.first, entry.second->value});
+            ++puts;
+        } else {
+            ops.push_back(WriteOp{WriteOp::Kind::Delete, entry.first, ""});
+        }
+    }
+    // Keys are distinct, so grouping puts before deletes keeps the batch to two runs
+    std::stable_partition(ops.begin(), ops.end(), [](const WriteOp& op) { return op.kind == WriteOp::Kind::Put; });
+
+    log_event("WRITE-BEHIND: Applying " + std::to_string(records.size()) + " WAL record(s) (" + std::to_string(puts) + " upsert(s), " + std::to_string(ops.size() - puts) + " delete(s))");
     try {
-        pqxx::connection conn = create_db_connection();
-        pqxx::nontransaction ntxn(conn);
-        
-        pqxx::result res = ntxn.exec("SELECT value FROM kv_store WHERE key = $1", pqxx::params{key});
-        
-        if (res.empty()) {
-            log_event("DB READ: Key '" + key + "' not found in database");
-            return std::nullopt; // Not found
+        storage->batch(ops, true);
+        return WriteBehindQueue::ApplyResult::Applied;
+    } catch (const RejectedWrite& e) {
+        std::cerr << "WAL Apply Error: " << e.what() << std::endl;
+        return WriteBehindQueue::ApplyResult::Rejected;
+    } catch (const std::exception& e) {
+        std::cerr << "WAL Apply Error: " << e.what() << std::endl;
+        return WriteBehindQueue::ApplyResult::Failed;
+    }
+}
+
+const bool write_behind_enabled = env_or("KV_WRITE_BEHIND", WRITE_BEHIND_ENABLED ? "on" : "off") == "on";
+WriteAheadLog wal(env_or("KV_WAL_DIR", WAL_DIR), WAL_SEGMENT_BYTES);
+WriteBehindQueue write_behind(wal, db_apply_wal_batch, WRITE_BEHIND_BATCH, WRITE_BEHIND_MAX_PENDING,
+                              std::chrono::milliseconds(WRITE_BEHIND_RETRY_MS));
+
+// Write-behind CREATE: durable in the local WAL, applied to Postgres later.
+// With wait_applied, also waits until the write has reached Postgres, and
+// fails if Postgres rejected it.
+bool wal_create(const std::string& key, const std::string& value, bool wait_applied = false) {
+    log_event("WAL CREATE: Logging key '" + key + "' with value length " + std::to_string(value.length()));
+    try {
+        auto lsn = write_behind.put(key, value);
+        if (!lsn) {
+            log_event("WAL CREATE: Backlog full, rejecting key '" + key + "'");
+            return false;
+        }
+        if (!wait_applied) return true;
+        switch (write_behind.wait_applied(*lsn, std::chrono::milliseconds(WRITE_BEHIND_SYNC_WAIT_MS))) {
+            case WriteBehindQueue::WaitResult::Applied:
+                return true;
+            case WriteBehindQueue::WaitResult::Rejected:
+                log_event("WAL CREATE: Database rejected key '" + key + "'");
+                return false;
+            case WriteBehindQueue::WaitResult::TimedOut:
+                break;
         }
-        std::string value = res[0][0].as<std::string>();
-        log_event("DB READ: Successfully fetched key '" + key + "' (value length: " + std::to_string(value.length()) + ")");
-        return value;
+        log_event("WAL CREATE: Timed out waiting for key '" + key + "' to reach the database");
+        return false;
     } catch (const std::exception& e) {
-        std::cerr << "DB Read Error: " << e.what() << std::endl;
-        log_event("DB READ: Failed for key '" + key + "' due to exception");
-        return std::nullopt;
+        std::cerr << "WAL Create Error: " << e.what() << std::endl;
+        return false;
     }
 }
 
-// DELETE operation
-bool db_delete(const std::string& key) {
-    log_event("DB DELETE: Attempting to delete key '" + key + "' from database");
+// Write-behind DELETE: logged as a tombstone, applied to Postgres later
+bool wal_delete(const std::string& key, bool wait_applied = false) {
+    log_event("WAL DELETE: Logging delete of key '" + key + "'");
     try {
-        pqxx::connection conn = create_db_connection();
-        pqxx::work txn(conn);
-        
-        pqxx::result res = txn.exec("DELETE FROM kv_store WHERE key = $1", pqxx::params{key});
-        txn.commit();
-        bool deleted = res.affected_rows() > 0;
-        if (deleted) {
-            log_event("DB DELETE: Successfully deleted key '" + key + "'");
+        auto lsn = write_behind.remove(key);
+        if (!lsn) {
+            log_event("WAL DELETE: Backlog full, rejecting key '" + key + "'");
+            return false;
+        }
+        if (!wait_applied) return true;
+        switch (write_behind.wait_applied(*lsn, std::chrono::milliseconds(WRITE_BEHIND_SYNC_WAIT_MS))) {
+            case WriteBehindQueue::WaitResult::Applied:
+                return true;
+            case WriteBehindQueue::WaitResult::Rejected:
+                log_event("WAL DELETE: Database rejected delete of key '" + key + "'");
+                return false;
+            case WriteBehindQueue::WaitResult::TimedOut:
+                break;
+        }
+        log_event("WAL DELETE: Timed out waiting for delete of key '" + key + "' to reach the database");
+        return false;
+    } catch (const std::exception& e) {
+        std::cerr << "WAL Delete Error: " << e.what() << std::endl;
+        return false;
+    }
+}
+
+// Outcome of a db_* operation, mapped to an HTTP status by the handlers
+enum class DbStatus {
+    Ok,
+    NotFound,
+    Failed,
+    Overloaded // Refused by the concurrency limiter without touching the backend
+};
+
+// Caps requests waiting on the storage backend. When the backend slows down,
+// the limit drops and the excess fails fast with 503 instead of queueing
+// (under httplib, also keeping server threads free for cache hits).
+ConcurrencyLimiter db_limiter([] {
+    ConcurrencyLimiter::Options options;
+    options.initial_limit = DB_LIMIT_INITIAL;
+    options.min_limit = DB_LIMIT_MIN;
+    options.max_limit = env_or("KV_FRONT_END", FRONT_END) == "httplib"
+                            ? DB_LIMIT_MAX_HTTPLIB
+                            : DB_LIMIT_MAX_EPOLL * static_cast<double>(std::max<size_t>(1, DB_SHARDS.size()));
+    options.tolerance = DB_LIMIT_TOLERANCE;
+    return options;
+}());
+
+// CREATE operation at the requested durability. A value the cache holds from
+// a synchronous write is not written again; any other unchanged value goes to
+// the backend, whose upsert leaves an identical row alone. A key
+// with a write still waiting in the WAL goes through the WAL as well: writing
+// it to Postgres directly would let the older logged write land on top of it
+// later. Sync and async writes then wait until the WAL has applied it.
+// done gets the outcome, from the batcher's flusher once the batch commits;
+// nothing waits for it in between.
+void db_create(const std::string& key, const std::string& value, Durability durability,
+               std::function<void(DbStatus)> done) {
+    // Clients often re-send the value a key already has: skip the write when
+    // the cache holds it as durably stored and nothing newer is waiting in the WAL
+    if (cache.matches_durable(key, value) && !write_behind.pending(key)) {
+        log_event("DB CREATE: Key '" + key + "' unchanged, skipping write");
+        done(DbStatus::Ok);
+        return;
+    }
+    if (durability == Durability::CacheOnly) {
+        done(wal_create(key, value) ? DbStatus::Ok : DbStatus::Failed);
+        return;
+    }
+
+    auto permit = db_limiter.try_acquire();
+    if (!permit) {
+        log_event("DB CREATE: Over the concurrency limit, shedding key '" + key + "'");
+        done(DbStatus::Overloaded);
+        return;
+    }
+    if (write_behind.pending(key)) {
+        log_event("DB CREATE: Key '" + key + "' has pending write-behind state, ordering the write through the WAL");
+        bool ok = wal_create(key, value, true);
+        if (!ok) permit->failed();
+        done(ok ? DbStatus::Ok : DbStatus::Failed);
+        return;
+    }
+    log_event("DB CREATE: Queueing insert/update of key '" + key + "' with value length " + std::to_string(value.length()));
+    auto held = std::make_shared<ConcurrencyLimiter::Permit>(std::move(*permit));
+    auto& batcher = durability == Durability::Sync ? write_batcher : async_write_batcher;
+    batcher.submit({key, value}, [key, held, done](bool ok) {
+        log_event(ok ? "DB CREATE: Successfully committed key '" + key + "'"
+                     : "DB CREATE: Failed for key '" + key + "'");
+        if (!ok) held->failed();
+        done(ok ? DbStatus::Ok : DbStatus::Failed);
+    });
+}
+
+// READ operation. done gets the outcome and value, from the database's event
+// loop for a cache miss, so it must not block.
+void db_read(const std::string& key, std::function<void(DbStatus, std::string)> done) {
+    // Writes still waiting in the WAL are newer than anything in the database
+    if (auto pending = write_behind.pending(key)) {
+        log_event("DB READ: Key '" + key + "' served from pending write-behind state");
+        if (!*pending) {
+            done(DbStatus::NotFound, "");
         } else {
-            log_event("DB DELETE: Key '" + key + "' not found (no rows affected)");
+            done(DbStatus::Ok, std::move(**pending));
         }
-        return deleted;
+        return;
+    }
+
+    auto permit = db_limiter.try_acquire();
+    if (!permit) {
+        log_event("DB READ: Over the concurrency limit, shedding key '" + key + "'");
+        done(DbStatus::Overloaded, "");
+        return;
+    }
+    log_event("DB READ: Fetching key '" + key + "' from database");
+    auto held = std::make_shared<ConcurrencyLimiter::Permit>(std::move(*permit));
+    read_batcher.submit(key, [key, held, done](ReadResult result) {
+        if (!result) {
+            held->failed();
+            log_event("DB READ: Fetching key '" + key + "' failed");
+            done(DbStatus::Failed, "");
+            return;
+        }
+        if (!*result) {
+            log_event("DB READ: Key '" + key + "' not found in database");
+            done(DbStatus::NotFound, "");
+            return;
+        }
+        log_event("DB READ: Successfully fetched key '" + key + "' (value length: " + std::to_string((*result)->length()) + ")");
+        done(DbStatus::Ok, std::move(**result));
+    });
+}
+
+// Batched DELETE: each request keeps its own affected-row answer, but the
+// whole batch is one backend batch (on Postgres, statements batched into
+// a single round trip and commit).
+// Failures complete with std::nullopt, so they are not mistaken for missing keys.
+std::vector<std::optional<bool>> db_delete_batch(const std::vector<std::string>& keys, bool durable) {
+    std::vector<WriteOp> ops;
+    ops.reserve(keys.size());
+    for (const auto& key : keys) ops.push_back(WriteOp{WriteOp::Kind::Delete, key, ""});
+
+    log_event("DB DELETE: Committing batch of " + std::to_string(keys.size()) + " delete(s)" + (durable ? "" : " without waiting for durability"));
+    try {
+        return db_batch_isolating(ops, durable);
     } catch (const std::exception& e) {
         std::cerr << "DB Delete Error: " << e.what() << std::endl;
-        log_event("DB DELETE: Failed for key '" + key + "' due to exception");
-        return false;
+        log_event("DB DELETE: Batch of " + std::to_string(keys.size()) + " delete(s) failed due to exception");
+        return std::vector<std::optional<bool>>(keys.size());
     }
 }
 
+// Concurrent DELETEs share one round trip and commit
+using DeleteBatcher = Batcher<std::string, std::optional<bool>>;
+DeleteBatcher delete_batcher(
+    "delete", DeleteBatcher::FlushFn([](const auto& keys) { return db_delete_batch(keys, true); }),
+    std::chrono::microseconds(DELETE_BATCH_WINDOW_US), DELETE_BATCH_MAX_ITEMS, DELETE_BATCH_FLUSHERS);
+DeleteBatcher async_delete_batcher(
+    "delete-async", DeleteBatcher::FlushFn([](const auto& keys) { return db_delete_batch(keys, false); }),
+    std::chrono::microseconds(DELETE_BATCH_WINDOW_US), DELETE_BATCH_MAX_ITEMS, DELETE_BATCH_FLUSHERS);
 
-// --- Main Server ---
-int main() {
-    log_event("Server startup: Initializing with " + std::to_string(SERVER_THREAD_COUNT) + " threads on port " + std::to_string(SERVER_PORT));
-    httplib::Server svr;
+// DELETE operation at the requested durability; see db_create for keys with
+// pending write-behind state and for when done runs
+void db_delete(const std::string& key, Durability durability, std::function<void(DbStatus)> done) {
+    if (durability == Durability::CacheOnly) {
+        done(wal_delete(key) ? DbStatus::Ok : DbStatus::Failed);
+        return;
+    }
+
+    auto permit = db_limiter.try_acquire();
+    if (!permit) {
+        log_event("DB DELETE: Over the concurrency limit, shedding key '" + key + "'");
+        done(DbStatus::Overloaded);
+        return;
+    }
+    if (auto pending = write_behind.pending(key)) {
+        log_event("DB DELETE: Key '" + key + "' has pending write-behind state, ordering the delete through the WAL");
+        // A pending tombstone means there is nothing left to delete
+        if (!pending->has_value()) {
+            done(DbStatus::NotFound);
+        } else if (wal_delete(key, true)) {
+            done(DbStatus::Ok);
+        } else {
+            permit->failed();
+            done(DbStatus::Failed);
+        }
+        return;
+    }
+
+    log_event("DB DELETE: Attempting to delete key '" + key + "' from database");
+    auto held = std::make_shared<ConcurrencyLimiter::Permit>(std::move(*permit));
+    auto& batcher = durability == Durability::Sync ? delete_batcher : async_delete_batcher;
+    batcher.submit(key, [key, held, done](std::optional<bool> deleted) {
+        if (!deleted) {
+            held->failed();
+            log_event("DB DELETE: Delete of key '" + key + "' failed");
+            done(DbStatus::Failed);
+        } else if (!*deleted) {
+            log_event("DB DELETE: Key '" + key + "' not found");
+            done(DbStatus::NotFound);
+        } else {
+            log_event("DB DELETE: Successfully deleted key '" + key + "'");
+            done(DbStatus::Ok);
+        }
+    });
+}
+
+// --- Background Refresh ---
+
+// Keys with a refresh in flight, so a hot stale (or refresh-ahead) key costs
+// one backend read rather than one per request
+std::mutex refresh_mutex;
+std::unordered_set<std::string> refreshing;
 
-    // Set a thread pool for the server
-    svr.new_task_queue = [] { 
-        return new httplib::ThreadPool(SERVER_THREAD_COUNT); 
+// Re-read a stale key, or a hot one about to go stale, without making any
+// request wait for it. The answer is
+// applied only if the cache still holds the value that was read as version,
+// so a refresh racing a write or delete never overwrites it. Skipped while
+// the backend is over its concurrency limit: the stale value stays served.
+void refresh_async(const std::string& key, uint64_t version) {
+    {
+        std::lock_guard<std::mutex> lock(refresh_mutex);
+        if (!refreshing.insert(key).second) return;
+    }
+    auto finish = [key] {
+        std::lock_guard<std::mutex> lock(refresh_mutex);
+        refreshing.erase(key);
     };
 
-    log_event("Server startup: Connecting to database...");
-    // Test database connection on startup
+    // Writes still waiting in the WAL are newer than anything in the database
+    if (auto pending = write_behind.pending(key)) {
+        cache.revalidate(key, version, *pending);
+        finish();
+        return;
+    }
+    auto permit = db_limiter.try_acquire();
+    if (!permit) {
+        log_event("CACHE: Over the concurrency limit, not refreshing key '" + key + "'");
+        finish();
+        return;
+    }
+
+    log_event("CACHE: Refreshing key '" + key + "' in the background");
+    auto held = std::make_shared<ConcurrencyLimiter::Permit>(std::move(*permit));
+    read_batcher.submit(key, [key, version, held, finish](ReadResult result) {
+        if (!result) {
+            held->failed();
+            log_event("CACHE: Background refresh of key '" + key + "' failed, keeping the cached value");
+        } else if (cache.revalidate(key, version, *result)) {
+            log_event("CACHE: Refreshed key '" + key + "'" + (*result ? "" : " (deleted in the database)"));
+        }
+        finish();
+    });
+}
+
+// SCAN operation: one page of keys with the prefix, after the given key (or
+// from the first, for std::nullopt). Reflects the backend only: cache-only
+// writes still in the write-behind log show up once applied.
+DbStatus db_scan(const std::string& prefix, const std::optional<std::string>& after, size_t limit,
+                 std::vector<std::pair<std::string, std::string>>& entries) {
+    auto permit = db_limiter.try_acquire();
+    if (!permit) {
+        log_event("DB SCAN: Over the concurrency limit, shedding scan of prefix '" + prefix + "'");
+        return DbStatus::Overloaded;
+    }
     try {
-        create_db_connection();
-        log_event("Server startup: Database connection successful");
+        entries = storage->scan(prefix, after, limit);
+        log_event("DB SCAN: Prefix '" + prefix + "'" + (after ? " after '" + *after + "'" : "") + " returned " + std::to_string(entries.size()) + " row(s)");
+        return DbStatus::Ok;
     } catch (const std::exception& e) {
-        std::cerr << "FATAL: Database connection failed: " << e.what() << std::endl;
-        log_event("Server startup: FATAL - Database connection failed");
-        return 1;
+        permit->failed();
+        std::cerr << "DB Scan Error: " << e.what() << std::endl;
+        log_event("DB SCAN: Scan of prefix '" + prefix + "' failed due to exception");
+        return DbStatus::Failed;
     }
+}
 
-    log_event("Server startup: Setting up RESTful endpoints");
+// Durability requested by the X-KV-Durability header; std::nullopt if
+// invalid, including cache-only while write-behind is disabled
+std::optional<Durability> request_durability(const httplib::Request& req) {
+    if (!req.has_header("X-KV-Durability")) return DEFAULT_DURABILITY;
+    std::string level = req.get_header_value("X-KV-Durability");
+    if (level == "sync") return Durability::Sync;
+    if (level == "async") return Durability::Async;
+    if (level == "cache-only" && write_behind_enabled) return Durability::CacheOnly;
+    return std::nullopt;
+}
+
+// 400 body for an invalid X-KV-Durability header
+std::string durability_error() {
+    return write_behind_enabled ? "{\"error\":\"X-KV-Durability must be sync, async or cache-only\"}"
+                                : "{\"error\":\"X-KV-Durability must be sync or async (write-behind is disabled)\"}";
+}
 
+// 503 for requests refused by the concurrency limiter
+void send_overloaded(httplib::Response& res) {
+    res.status = 503; // Service Unavailable
+    res.set_header("Retry-After", "1");
+    res.set_content("{\"error\":\"Database overloaded, retry later\"}", "application/json");
+}
+
+// Shared by POST /kv and PUT /kv/<key>: persist at the requested durability,
+// then cache, and finish the request once the write is answered
+void store_key(const std::string& route, const std::string& key, const std::string& value,
+               const httplib::Request& req, httplib::Response& res, const EventServer::Done& done) {
+    auto durability = request_durability(req);
+    if (!durability) {
+        log_event("HTTP REQUEST: " + route + " - Invalid X-KV-Durability header");
+        res.status = 400; // Bad Request
+        res.set_content(durability_error(), "application/json");
+        done();
+        return;
+    }
+
+    mrc_profiler.record(key, false);
+
+    // 1. Store in database (or the local WAL for cache-only durability)
+    bool sync = *durability == Durability::Sync;
+    db_create(key, value, *durability, [route, key, value, sync, &res, done](DbStatus status) {
+        if (status == DbStatus::Ok) {
+            // 2. Store in cache
+            log_event("CACHE: Putting key '" + key + "' into LRU cache");
+            cache.put(key, value, sync);
+            log_event("HTTP RESPONSE: " + route + " - Created successfully for key '" + key + "'");
+            res.status = 201; // Created
+            res.set_content("{\"status\":\"created\", \"key\":\"" + key + "\"}", "application/json");
+        } else if (status == DbStatus::Overloaded) {
+            log_event("HTTP RESPONSE: " + route + " - Shed key '" + key + "', database overloaded");
+            send_overloaded(res);
+        } else {
+            log_event("HTTP RESPONSE: " + route + " - Failed to create key '" + key + "'");
+            res.status = 500; // Internal Server Error
+            res.set_content("{\"error\":\"Failed to write to database\"}", "application/json");
+        }
+        done();
+    });
+}
+
+// GET /kv/<key> answers with the raw value bytes when the client accepts
+// application/octet-stream, and with JSON otherwise. JSON cannot carry
+// arbitrary bytes, so invalid UTF-8 there is replaced with U+FFFD.
+void send_value(const httplib::Request& req, httplib::Response& res, const std::string& key,
+                const std::string& value, const std::string& source) {
+    if (req.get_header_value("Accept").find("application/octet-stream") != std::string::npos) {
+        res.set_header("X-KV-Source", source);
+        res.set_content(value, "application/octet-stream");
+        return;
+    }
+    json j_res = {{"key", key}, {"value", value}, {"source", source}};
+    res.set_content(j_res.dump(-1, ' ', false, json::error_handler_t::replace), "application/json");
+}
+
+// Exports running now (GET /admin/export), capped at EXPORT_MAX_CONCURRENT
+std::atomic<int> active_exports{0};
+
+// Registers an asynchronous handler, which finishes its request from the
+// callback that completes the database work. EventServer writes the response
+// from there, so no thread waits on the database; httplib::Server holds a
+// thread for the whole request anyway, so that thread waits for done.
+template <typename Server>
+void route_async(Server& svr, const std::string& method, const std::string& pattern,
+                 EventServer::AsyncHandler handler) {
+    if constexpr (std::is_same_v<Server, EventServer>) {
+        if (method == "GET") svr.GetAsync(pattern, std::move(handler));
+        if (method == "POST") svr.PostAsync(pattern, std::move(handler));
+        if (method == "PUT") svr.PutAsync(pattern, std::move(handler));
+        if (method == "DELETE") svr.DeleteAsync(pattern, std::move(handler));
+    } else {
+        httplib::Server::Handler blocking = [handler](const httplib::Request& req, httplib::Response& res) {
+            auto finished = std::make_shared<std::promise<void>>();
+            auto answered = finished->get_future();
+            handler(req, res, [finished] { finished->set_value(); });
+            answered.wait();
+        };
+        if (method == "GET") svr.Get(pattern, blocking);
+        if (method == "POST") svr.Post(pattern, blocking);
+        if (method == "PUT") svr.Put(pattern, blocking);
+        if (method == "DELETE") svr.Delete(pattern, blocking);
+    }
+}
+
+// Registers every endpoint on svr, an httplib::Server or an EventServer
+// (both take the same handler signatures)
+template <typename Server>
+void register_endpoints(Server& svr) {
     // === RESTful Endpoints ===
 
     // 1. CREATE (POST /kv)
     // Body: {"key": "my_key", "value": "my_value"}
-    svr.Post("/kv", [](const httplib::Request& req, httplib::Response& res) {
+    route_async(svr, "POST", "/kv", [](const httplib::Request& req, httplib::Response& res, EventServer::Done done) {
         log_event("HTTP REQUEST: POST /kv - Body length: " + std::to_string(req.body.length()) + ", Headers: " + std::to_string(req.headers.size()));
         json j;
         try {
@@ -131,6 +866,7 @@ int main() {
             log_event("HTTP REQUEST: POST /kv - Invalid JSON in body");
             res.status = 400; // Bad Request
             res.set_content("{\"error\":\"Invalid JSON format\"}", "application/json");
+            done();
             return;
         }
 
@@ -138,6 +874,7 @@ int main() {
             log_event("HTTP REQUEST: POST /kv - Missing 'key' or 'value' in JSON");
             res.status = 400; // Bad Request
             res.set_content("{\"error\":\"Missing 'key' or 'value'\"}", "application/json");
+            done();
             return;
         }
 
@@ -145,78 +882,525 @@ int main() {
         std::string value = j["value"];
         log_event("HTTP REQUEST: POST /kv - Parsed key: '" + key + "', value length: " + std::to_string(value.length()));
 
-        // 1. Store in database
-        if (db_create(key, value)) {
-            // 2. Store in cache
-            log_event("CACHE: Putting key '" + key + "' into LRU cache");
-            cache.put(key, value);
-            log_event("HTTP RESPONSE: POST /kv - Created successfully for key '" + key + "'");
-            res.status = 201; // Created
-            res.set_content("{\"status\":\"created\", \"key\":\"" + key + "\"}", "application/json");
-        } else {
-            log_event("HTTP RESPONSE: POST /kv - Failed to create key '" + key + "'");
+        store_key("POST /kv", key, value, req, res, done);
+    });
+
+    // 1b. CREATE with a raw value (PUT /kv/<key>)
+    // Body: the value bytes as-is (any content type), e.g. application/octet-stream
+    route_async(svr, "PUT", R"(/kv/(.+))", [](const httplib::Request& req, httplib::Response& res,
+                                              EventServer::Done done) {
+        std::string key = req.matches[1];
+        log_event("HTTP REQUEST: PUT /kv/" + key + " - Body length: " + std::to_string(req.body.length()) + ", Headers: " + std::to_string(req.headers.size()));
+        store_key("PUT /kv/" + key, key, req.body, req, res, done);
+    });
+
+    // 1c. BULK IMPORT (POST /kv/import)
+    // Body: NDJSON ({"key":..., "value":...} per line) or CSV (key,value), streamed.
+    // Format from ?format=ndjson|csv or the Content-Type; ?header=true skips a CSV
+    // header, ?cache=true also caches the imported values. Every IMPORT_BATCH_ROWS
+    // rows are committed as one bulk write, so on an error the rows before the
+    // failing batch stay imported.
+    svr.Post("/kv/import", [](const httplib::Request& req, httplib::Response& res,
+                              const httplib::ContentReader& content_reader) {
+        std::string format = req.has_param("format") ? req.get_param_value("format")
+                             : req.get_header_value("Content-Type").find("csv") != std::string::npos ? "csv"
+                             : "ndjson";
+        if (format != "ndjson" && format != "csv") {
+            res.status = 400; // Bad Request
+            res.set_content("{\"error\":\"format must be ndjson or csv\"}", "application/json");
+            return;
+        }
+        bool populate_cache = req.get_param_value("cache") == "true";
+        log_event("HTTP REQUEST: POST /kv/import - Format " + format + (populate_cache ? ", populating cache" : ""));
+
+        std::vector<std::pair<std::string, std::string>> rows;
+        size_t imported = 0;
+        size_t batches = 0;
+        // A key still waiting in the write-behind WAL must be written through
+        // it, or the older logged write would land on top of the import later
+        auto flush = [&] {
+            std::vector<std::pair<std::string, std::string>> direct;
+            direct.reserve(rows.size());
+            for (auto& row : rows) {
+                if (!write_behind.pending(row.first)) {
+                    direct.push_back(std::move(row));
+                } else if (!wal_create(row.first, row.second, true)) {
+                    throw std::runtime_error("write-behind apply failed for key '" + row.first + "'");
+                } else if (populate_cache) {
+                    cache.put(row.first, row.second);
+                } else {
+                    cache.remove(row.first);
+                }
+            }
+            storage->bulk_put(direct);
+            for (const auto& row : direct) {
+                // Drop (or refresh) any cached copy of an overwritten key
+                if (populate_cache) {
+                    cache.put(row.first, row.second, true); // bulk_put is durable
+                } else {
+                    cache.remove(row.first);
+                }
+            }
+            imported += rows.size();
+            ++batches;
+            rows.clear();
+            log_event("IMPORT: Committed batch " + std::to_string(batches) + ", " + std::to_string(imported) + " row(s) so far");
+        };
+
+        ImportReader reader(format == "csv" ? ImportReader::Format::CSV : ImportReader::Format::NDJSON,
+                            [&](std::string key, std::string value) {
+                                rows.emplace_back(std::move(key), std::move(value));
+                                if (rows.size() >= IMPORT_BATCH_ROWS) flush();
+                            },
+                            req.get_param_value("header") == "true");
+        std::string parse_error;
+        std::string db_error;
+        bool received = content_reader([&](const char* data, size_t len) {
+            try {
+                reader.feed(data, len);
+                return true;
+            } catch (const std::invalid_argument& e) {
+                parse_error = e.what();
+            } catch (const std::exception& e) {
+                db_error = e.what();
+            }
+            return false; // Stop reading the body
+        });
+        if (!received && parse_error.empty() && db_error.empty()) parse_error = "request body cut short";
+        if (parse_error.empty() && db_error.empty()) {
+            try {
+                reader.finish();
+                if (!rows.empty()) flush();
+            } catch (const std::invalid_argument& e) {
+                parse_error = e.what();
+            } catch (const std::exception& e) {
+                db_error = e.what();
+            }
+        }
+
+        json j_res = {{"imported", imported}, {"batches", batches}};
+        if (!parse_error.empty()) {
+            log_event("HTTP RESPONSE: POST /kv/import - Bad input after " + std::to_string(imported) + " row(s): " + parse_error);
+            res.status = 400; // Bad Request
+            j_res["error"] = parse_error;
+        } else if (!db_error.empty()) {
+            std::cerr << "DB Import Error: " << db_error << std::endl;
+            log_event("HTTP RESPONSE: POST /kv/import - Failed after " + std::to_string(imported) + " row(s): " + db_error);
             res.status = 500; // Internal Server Error
-            res.set_content("{\"error\":\"Failed to write to database\"}", "application/json");
+            j_res["error"] = "Failed to write to database";
+        } else {
+            log_event("HTTP RESPONSE: POST /kv/import - Imported " + std::to_string(imported) + " row(s)");
+            j_res["status"] = "imported";
         }
+        res.set_content(j_res.dump(-1, ' ', false, json::error_handler_t::replace), "application/json");
     });
 
     // 2. READ (GET /kv/<key>)
-    svr.Get(R"(/kv/(.+))", [](const httplib::Request& req, httplib::Response& res) {
+    route_async(svr, "GET", R"(/kv/(.+))", [](const httplib::Request& req, httplib::Response& res,
+                                              EventServer::Done done) {
         std::string key = req.matches[1];
         log_event("HTTP REQUEST: GET /kv/" + key + " - Headers: " + std::to_string(req.headers.size()));
 
+        mrc_profiler.record(key, true);
+
         // 1. Check cache
         log_event("CACHE: Attempting get for key '" + key + "'");
-        auto cache_val = cache.get(key);
-        if (cache_val) {
+        auto cached = cache.lookup(key);
+        if (cached && cached->freshness == Freshness::Fresh) {
             // Cache Hit
-            log_event("CACHE: HIT for key '" + key + "' (value length: " + std::to_string(cache_val->length()) + ")");
-            json j_res = {{"key", key}, {"value", *cache_val}, {"source", "cache"}};
-            res.set_content(j_res.dump(), "application/json");
+            log_event("CACHE: HIT for key '" + key + "' (value length: " + std::to_string(cached->value.length()) + ")");
+            // Refresh-ahead: reload a hot key before it goes stale
+            if (cached->refresh_due) refresh_async(key, cached->version);
+            send_value(req, res, key, cached->value, "cache");
             log_event("HTTP RESPONSE: GET /kv/" + key + " - Served from cache");
+            done();
+            return;
+        }
+        if (cached && cached->freshness == Freshness::Stale) {
+            // Stale-while-revalidate: answer now, refresh in the background
+            log_event("CACHE: STALE HIT for key '" + key + "'");
+            refresh_async(key, cached->version);
+            send_value(req, res, key, cached->value, "stale");
+            log_event("HTTP RESPONSE: GET /kv/" + key + " - Served stale from cache");
+            done();
             return;
         }
-        log_event("CACHE: MISS for key '" + key + "'");
+        log_event(cached ? "CACHE: EXPIRED for key '" + key + "'" : "CACHE: MISS for key '" + key + "'");
 
-        // 2. Cache Miss: Fetch from database
-        auto db_val = db_read(key);
-        if (db_val) {
-            // 3. Insert into cache
-            log_event("CACHE: Putting key '" + key + "' into LRU cache after DB fetch");
-            cache.put(key, *db_val);
-            json j_res = {{"key", key}, {"value", *db_val}, {"source", "database"}};
-            res.set_content(j_res.dump(), "application/json");
-            log_event("HTTP RESPONSE: GET /kv/" + key + " - Served from database and cached");
-        } else {
-            log_event("HTTP RESPONSE: GET /kv/" + key + " - Key not found");
-            res.status = 404; // Not Found
-            res.set_content("{\"error\":\"Key not found\", \"key\":\"" + key + "\"}", "application/json");
+        // 2. Cache Miss: Fetch from database; the request finishes when the read does
+        uint64_t fill_token = cache.fill_token(key);
+        db_read(key, [&req, &res, done, key, cached, fill_token](DbStatus status, std::string db_val) {
+            if (status == DbStatus::Ok) {
+                // 3. Insert into cache, unless a write or invalidation overtook the read
+                log_event("CACHE: Putting key '" + key + "' into LRU cache after DB fetch");
+                if (!cache.fill(key, db_val, fill_token)) {
+                    log_event("CACHE: Key '" + key + "' changed during the DB fetch, not caching the result");
+                }
+                send_value(req, res, key, db_val, "database");
+                log_event("HTTP RESPONSE: GET /kv/" + key + " - Served from database and cached");
+            } else if (cached && (status == DbStatus::Overloaded || status == DbStatus::Failed)) {
+                // Stale-if-error: an expired value beats no answer
+                res.set_header("Warning", "111 - \"Revalidation Failed\"");
+                send_value(req, res, key, cached->value, "stale");
+                log_event("HTTP RESPONSE: GET /kv/" + key + " - Database unavailable, served expired value from cache");
+            } else if (status == DbStatus::Overloaded) {
+                log_event("HTTP RESPONSE: GET /kv/" + key + " - Shed, database overloaded");
+                send_overloaded(res);
+            } else if (status == DbStatus::Failed) {
+                log_event("HTTP RESPONSE: GET /kv/" + key + " - Database read failed");
+                res.status = 500; // Internal Server Error
+                res.set_content("{\"error\":\"Failed to read from database\", \"key\":\"" + key + "\"}", "application/json");
+            } else {
+                log_event("HTTP RESPONSE: GET /kv/" + key + " - Key not found");
+                res.status = 404; // Not Found
+                res.set_content("{\"error\":\"Key not found\", \"key\":\"" + key + "\"}", "application/json");
+            }
+            done();
+        });
+    });
+
+    // 2b. SCAN (GET /kv?prefix=...&after=...&limit=...)
+    // Keyset pagination: pass the returned next_after as after for the next
+    // page. Without after the scan starts at the first key, the empty key
+    // included; after= (empty) resumes behind the empty key.
+    svr.Get("/kv", [](const httplib::Request& req, httplib::Response& res) {
+        std::string prefix = req.get_param_value("prefix");
+        std::optional<std::string> after;
+        if (req.has_param("after")) after = req.get_param_value("after");
+        size_t limit = SCAN_DEFAULT_LIMIT;
+        if (req.has_param("limit")) {
+            try {
+                limit = std::stoul(req.get_param_value("limit"));
+            } catch (...) {
+                limit = 0;
+            }
+            if (limit == 0 || limit > SCAN_MAX_LIMIT) {
+                res.status = 400; // Bad Request
+                res.set_content("{\"error\":\"limit must be between 1 and " + std::to_string(SCAN_MAX_LIMIT) + "\"}", "application/json");
+                return;
+            }
+        }
+        log_event("HTTP REQUEST: GET /kv - Scan prefix '" + prefix + "'" + (after ? " after '" + *after + "'" : "") + " limit " + std::to_string(limit));
+
+        std::vector<std::pair<std::string, std::string>> entries;
+        DbStatus status = db_scan(prefix, after, limit, entries);
+        if (status == DbStatus::Overloaded) {
+            send_overloaded(res);
+            return;
+        }
+        if (status != DbStatus::Ok) {
+            res.status = 500; // Internal Server Error
+            res.set_content("{\"error\":\"Failed to scan database\"}", "application/json");
+            return;
         }
+
+        json items = json::array();
+        for (const auto& entry : entries) items.push_back({{"key", entry.first}, {"value", entry.second}});
+        json j_res = {{"items", std::move(items)}};
+        // A short page means the range is exhausted
+        j_res["next_after"] = entries.size() == limit ? json(entries.back().first) : json(nullptr);
+        res.set_content(j_res.dump(-1, ' ', false, json::error_handler_t::replace), "application/json");
+        log_event("HTTP RESPONSE: GET /kv - Returned " + std::to_string(entries.size()) + " row(s)");
     });
 
     // 3. DELETE (DELETE /kv/<key>)
-    svr.Delete(R"(/kv/(.+))", [](const httplib::Request& req, httplib::Response& res) {
+    route_async(svr, "DELETE", R"(/kv/(.+))", [](const httplib::Request& req, httplib::Response& res,
+                                                 EventServer::Done done) {
         std::string key = req.matches[1];
         log_event("HTTP REQUEST: DELETE /kv/" + key + " - Headers: " + std::to_string(req.headers.size()));
 
-        // 1. Delete from database
-        if (db_delete(key)) {
-            // 2. Delete from cache
-            log_event("CACHE: Removing key '" + key + "' from LRU cache");
-            cache.remove(key);
-            log_event("HTTP RESPONSE: DELETE /kv/" + key + " - Deleted successfully");
-            res.status = 200;
-            res.set_content("{\"status\":\"deleted\", \"key\":\"" + key + "\"}", "application/json");
-        } else {
-            log_event("HTTP RESPONSE: DELETE /kv/" + key + " - Delete failed (not found or error)");
-            res.status = 404;
-            res.set_content("{\"error\":\"Key not found or delete failed\", \"key\":\"" + key + "\"}", "application/json");
+        auto durability = request_durability(req);
+        if (!durability) {
+            log_event("HTTP REQUEST: DELETE /kv/" + key + " - Invalid X-KV-Durability header");
+            res.status = 400; // Bad Request
+            res.set_content(durability_error(), "application/json");
+            done();
+            return;
+        }
+
+        // 1. Delete from database (or log a tombstone for cache-only durability)
+        db_delete(key, *durability, [&res, done, key](DbStatus status) {
+            if (status == DbStatus::Ok) {
+                // 2. Delete from cache
+                log_event("CACHE: Removing key '" + key + "' from LRU cache");
+                cache.remove(key);
+                log_event("HTTP RESPONSE: DELETE /kv/" + key + " - Deleted successfully");
+                res.status = 200;
+                res.set_content("{\"status\":\"deleted\", \"key\":\"" + key + "\"}", "application/json");
+            } else if (status == DbStatus::Overloaded) {
+                log_event("HTTP RESPONSE: DELETE /kv/" + key + " - Shed, database overloaded");
+                send_overloaded(res);
+            } else if (status == DbStatus::Failed) {
+                log_event("HTTP RESPONSE: DELETE /kv/" + key + " - Delete failed");
+                res.status = 500; // Internal Server Error
+                res.set_content("{\"error\":\"Failed to delete from database\", \"key\":\"" + key + "\"}", "application/json");
+            } else {
+                log_event("HTTP RESPONSE: DELETE /kv/" + key + " - Key not found");
+                res.status = 404;
+                res.set_content("{\"error\":\"Key not found\", \"key\":\"" + key + "\"}", "application/json");
+            }
+            done();
+        });
+    });
+
+    // === Admin Endpoints ===
+
+    // Cache stats (GET /admin/cache)
+    svr.Get("/admin/cache", [](const httplib::Request&, httplib::Response& res) {
+        json j_res = {
+            {"policy", cache.policy() == EvictionPolicy::SLRU ? "slru" : "lru"},
+            {"capacity", cache.capacity()},
+            {"max_capacity", cache_capacity_ceiling.load()},
+            {"size", cache.size()},
+            {"protected_size", cache.protected_size()}
+        };
+        res.set_content(j_res.dump(), "application/json");
+    });
+
+    // Storage backend load (GET /admin/db)
+    svr.Get("/admin/db", [](const httplib::Request&, httplib::Response& res) {
+        auto latency = db_limiter.latency_us();
+        json j_res = {
+            {"backend", storage->name()},
+            {"concurrency_limit", db_limiter.limit()},
+            {"in_flight", db_limiter.in_flight()},
+            {"rejected", db_limiter.rejected()},
+            {"baseline_latency_us", latency.first},
+            {"recent_latency_us", latency.second}
+        };
+        res.set_content(j_res.dump(), "application/json");
+    });
+
+    // Full export (GET /admin/export?prefix=...)
+    // Streams every matching row as chunked NDJSON, one {"key", "value"} per
+    // line in key order, fetched EXPORT_FETCH_ROWS at a time from a backend
+    // cursor (on Postgres, a server-side cursor over one snapshot). A stream
+    // that ends without the final empty chunk was cut short by an error.
+    svr.Get("/admin/export", [](const httplib::Request& req, httplib::Response& res) {
+        std::string prefix = req.get_param_value("prefix");
+        log_event("HTTP REQUEST: GET /admin/export - Prefix '" + prefix + "'");
+        if (++active_exports > EXPORT_MAX_CONCURRENT) {
+            --active_exports;
+            log_event("HTTP RESPONSE: GET /admin/export - Too many exports running");
+            send_overloaded(res);
+            return;
         }
+
+        // Shared by the provider and releaser; frees the export slot when the response is done
+        struct Export {
+            std::unique_ptr<StorageCursor> cursor;
+            size_t rows = 0;
+            ~Export() { --active_exports; }
+        };
+        auto state = std::make_shared<Export>();
+        try {
+            state->cursor = storage->open_cursor(prefix);
+        } catch (const std::exception& e) {
+            std::cerr << "DB Export Error: " << e.what() << std::endl;
+            log_event("HTTP RESPONSE: GET /admin/export - Failed to open cursor");
+            res.status = 500; // Internal Server Error
+            res.set_content("{\"error\":\"Failed to read from database\"}", "application/json");
+            return;
+        }
+
+        res.set_chunked_content_provider("application/x-ndjson",
+            [state](size_t, httplib::DataSink& sink) {
+                std::vector<std::pair<std::string, std::string>> entries;
+                try {
+                    entries = state->cursor->next(EXPORT_FETCH_ROWS);
+                } catch (const std::exception& e) {
+                    std::cerr << "DB Export Error: " << e.what() << std::endl;
+                    log_event("EXPORT: Fetch failed after " + std::to_string(state->rows) + " row(s), aborting the stream");
+                    return false;
+                }
+                if (entries.empty()) {
+                    sink.done();
+                    return true;
+                }
+                std::string chunk;
+                for (const auto& entry : entries) {
+                    chunk += json{{"key", entry.first}, {"value", entry.second}}.dump(-1, ' ', false, json::error_handler_t::replace);
+                    chunk += '\n';
+                }
+                state->rows += entries.size();
+                return sink.write(chunk.data(), chunk.size());
+            },
+            [state](bool success) {
+                log_event("HTTP RESPONSE: GET /admin/export - " + std::string(success ? "Finished" : "Aborted") +
+                          " after " + std::to_string(state->rows) + " row(s)");
+            });
     });
 
-    log_event("Server startup: All endpoints registered, starting listener on 0.0.0.0:" + std::to_string(SERVER_PORT));
-    // Start listening
-    svr.listen("0.0.0.0", SERVER_PORT);
+    // Resize cache (PUT /admin/cache/capacity)
+    // Body: {"capacity": 5000}
+    svr.Put("/admin/cache/capacity", [](const httplib::Request& req, httplib::Response& res) {
+        log_event("HTTP REQUEST: PUT /admin/cache/capacity - Body length: " + std::to_string(req.body.length()));
+        json j;
+        try {
+            j = json::parse(req.body);
+        } catch (...) {
+            res.status = 400;
+            res.set_content("{\"error\":\"Invalid JSON format\"}", "application/json");
+            return;
+        }
+
+        if (!j.contains("capacity") || !j["capacity"].is_number_unsigned()
+            || j["capacity"].get<size_t>() == 0 || j["capacity"].get<size_t>() > CACHE_MAX_CAPACITY) {
+            res.status = 400;
+            res.set_content("{\"error\":\"'capacity' must be an integer between 1 and " + std::to_string(CACHE_MAX_CAPACITY) + "\"}", "application/json");
+            return;
+        }
+
+        resize_cache(j["capacity"].get<size_t>());
+        json j_res = {{"capacity", cache.capacity()}, {"max_capacity", cache_capacity_ceiling.load()}, {"size", cache.size()}};
+        res.set_content(j_res.dump(), "application/json");
+    });
+
+    // Estimated hit ratio vs cache size (GET /admin/cache/mrc?points=20&max_size=100000)
+    svr.Get("/admin/cache/mrc", [](const httplib::Request& req, httplib::Response& res) {
+        size_t points = 20;
+        size_t max_size = std::min(mrc_profiler.max_size(), std::max<size_t>(cache_capacity_ceiling * 4, MRC_BUCKET_SIZE));
+        try {
+            if (req.has_param("points")) points = std::stoul(req.get_param_value("points"));
+            if (req.has_param("max_size")) max_size = std::stoul(req.get_param_value("max_size"));
+        } catch (...) {
+            res.status = 400;
+            res.set_content("{\"error\":\"'points' and 'max_size' must be positive integers\"}", "application/json");
+            return;
+        }
+        if (points == 0 || points > 1000 || max_size == 0) {
+            res.status = 400;
+            res.set_content("{\"error\":\"'points' must be 1-1000 and 'max_size' positive\"}", "application/json");
+            return;
+        }
+        max_size = std::min(max_size, mrc_profiler.max_size());
+
+        std::vector<size_t> sizes;
+        for (size_t i = 1; i <= points; ++i) {
+            sizes.push_back(std::max<size_t>(1, max_size * i / points));
+        }
+
+        json curve = json::array();
+        for (const auto& point : mrc_profiler.hit_ratio_curve(sizes)) {
+            curve.push_back({{"cache_size", point.first}, {"hit_ratio", point.second}});
+        }
+        json j_res = {
+            {"sampling_rate", mrc_profiler.sampling_rate()},
+            {"sampled_keys", mrc_profiler.sampled_keys()},
+            {"reads", mrc_profiler.total_reads()},
+            {"current_capacity", cache.capacity()},
+            {"curve", curve}
+        };
+        res.set_content(j_res.dump(), "application/json");
+    });
+}
+
+// --- Main Server ---
+int main() {
+    log_event("Server startup: Initializing with " + std::to_string(SERVER_THREAD_COUNT) + " threads on port " + std::to_string(SERVER_PORT));
+    // Connect to (or recover) the storage backend on startup
+    try {
+        storage = make_storage_backend();
+        log_event("Server startup: Opening " + storage->name() + " storage backend...");
+        storage->open();
+        log_event("Server startup: Storage backend ready");
+    } catch (const std::exception& e) {
+        std::cerr << "FATAL: Storage backend failed to open: " << e.what() << std::endl;
+        log_event("Server startup: FATAL - Storage backend failed to open");
+        return 1;
+    }
+
+    // Drop keys other instances write to the same kv_store. NOTIFY is per
+    // database, so each shard needs its own listener.
+    std::vector<std::unique_ptr<InvalidationListener>> invalidation_listeners;
+    if (env_or("KV_STORAGE_BACKEND", STORAGE_BACKEND) == "postgres" && !INVALIDATION_CHANNEL.empty()) {
+        std::vector<std::string> databases;
+        for (const auto& shard : DB_SHARDS) databases.push_back(shard.second);
+        if (databases.empty()) databases.push_back(DB_CONNECTION_STRING);
+        for (const auto& database : databases) {
+            invalidation_listeners.push_back(std::make_unique<InvalidationListener>(
+                database, INVALIDATION_CHANNEL, instance_id,
+                std::chrono::milliseconds(INVALIDATION_BATCH_WINDOW_MS),
+                [](const std::vector<std::string>& keys) {
+                    // The next miss must not read an older value from a lagging replica
+                    storage->note_external_writes(keys);
+                    for (const auto& key : keys) cache.remove(key);
+                },
+                [] { cache.clear(); }));
+            invalidation_listeners.back()->start();
+        }
+        log_event("Server startup: Cache invalidation via NOTIFY on '" + INVALIDATION_CHANNEL + "' as instance " + instance_id);
+    }
+
+    // Background eviction for runtime cache shrinks
+    std::thread(cache_trimmer_loop).detach();
+
+    if (MEMORY_AUTOSCALE_ENABLED) {
+        MemoryMonitor monitor;
+        if (monitor.available()) {
+            log_event("Server startup: Watching cgroup memory at " + monitor.path());
+            std::thread(memory_autoscaler_loop, monitor).detach();
+        } else {
+            log_event("Server startup: No cgroup memory controller found, cache autoscaling disabled");
+        }
+    }
+
+    // Replay writes acknowledged from the WAL but not yet applied before a
+    // crash, so the database is caught up before any request is served. With
+    // write-behind disabled the WAL is only touched if an earlier run left
+    // segments behind, and then only to drain them.
+    if (DEFAULT_DURABILITY == Durability::CacheOnly && !write_behind_enabled) {
+        std::cerr << "FATAL: DEFAULT_DURABILITY is cache-only but write-behind is disabled" << std::endl;
+        log_event("Server startup: FATAL - cache-only default durability needs write-behind");
+        return 1;
+    }
+    try {
+        if (write_behind_enabled || wal.has_segments()) {
+            if (!write_behind_enabled) log_event("Server startup: Write-behind is disabled, draining the WAL left by an earlier run");
+            write_behind.start(wal.recover());
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "FATAL: WAL recovery failed: " << e.what() << std::endl;
+        log_event("Server startup: FATAL - WAL recovery failed");
+        return 1;
+    }
+    while (size_t backlog = write_behind.backlog()) {
+        log_event("Server startup: Waiting for " + std::to_string(backlog) + " recovered WAL record(s) to reach the database");
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+
+    log_event("Server startup: Setting up RESTful endpoints");
+    std::string front_end = env_or("KV_FRONT_END", FRONT_END);
+    if (front_end == "epoll") {
+        EventServer::Options options;
+        options.io_threads = EVENT_IO_THREADS;
+        options.worker_threads = SERVER_THREAD_COUNT;
+        options.max_connections = EVENT_MAX_CONNECTIONS;
+        options.max_body_bytes = EVENT_MAX_BODY_BYTES;
+        options.idle_timeout = std::chrono::milliseconds(EVENT_IDLE_TIMEOUT_MS);
+        EventServer svr(options);
+        register_endpoints(svr);
+        log_event("Server startup: All endpoints registered, starting event-driven listener on 0.0.0.0:" + std::to_string(SERVER_PORT));
+        if (!svr.listen("0.0.0.0", SERVER_PORT)) {
+            log_event("Server startup: FATAL - Could not listen on port " + std::to_string(SERVER_PORT));
+            return 1;
+        }
+    } else if (front_end == "httplib") {
+        httplib::Server svr;
+
+        // Set a thread pool for the server
+        svr.new_task_queue = [] { 
+            return new httplib::ThreadPool(SERVER_THREAD_COUNT); 
+        };
+        register_endpoints(svr);
+        log_event("Server startup: All endpoints registered, starting listener on 0.0.0.0:" + std::to_string(SERVER_PORT));
+        // Start listening
+        svr.listen("0.0.0.0", SERVER_PORT);
+    } else {
+        std::cerr << "FATAL: Unknown front end: " << front_end << std::endl;
+        log_event("Server startup: FATAL - Unknown front end " + front_end);
+        return 1;
+    }
     log_event("Server shutdown: Listener stopped");
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,20 @@
+// check.h
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <cstdlib>
+#include <iostream>
+
+// Minimal assertions for the unit tests: report the failing expression and
+// its location, then exit non-zero
+#define CHECK(condition)                                                                  \
+    do {                                                                                  \
+        if (!(condition)) {                                                               \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK failed: " #condition << std::endl; \
+            std::exit(1);                                                                 \
+        }                                                                                 \
+    } while (0)
+
+#define CHECK_EQ(actual, expected) CHECK((actual) == (expected))
+
+#endif // CHECK_H
@@ -0,0 +1,233 @@
+// Unit tests for EventServer::RequestParser: framing, pipelining, limits and
+// streamed bodies
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+#include "event_server.h"
+#include "check.h"
+
+using Parser = EventServer::RequestParser;
+using Result = Parser::Result;
+
+// What parsing some input produced
+struct Parsed {
+    std::vector<std::shared_ptr<httplib::Request>> requests; // Complete ones
+    std::string streamed; // Streamed body bytes, across requests
+    size_t heads = 0; // Head results
+    int error = 0; // Status of the error that stopped parsing
+};
+
+// Feeds input in chunks of chunk bytes (0: all at once), the way a
+// connection appends whatever arrived, parses on and drops consumed bytes
+static Parsed parse(Parser& parser, const std::string& input, size_t chunk = 0) {
+    Parsed parsed;
+    std::string in;
+    size_t pos = 0;
+    if (chunk == 0) chunk = std::max<size_t>(1, input.size());
+    for (size_t i = 0; i < input.size() && !parsed.error; i += chunk) {
+        in.append(input, i, chunk);
+        for (;;) {
+            Result result = parser.parse(in, pos);
+            parsed.streamed += parser.take_body();
+            if (result == Result::NeedMore) break;
+            if (result == Result::Error) {
+                parsed.error = parser.error_status();
+                break;
+            }
+            if (result == Result::Head) {
+                ++parsed.heads;
+            } else {
+                parsed.requests.push_back(parser.take());
+            }
+        }
+        if (pos == in.size()) {
+            in.clear();
+            pos = 0;
+        } else if (pos >= 64) {
+            in.erase(0, pos);
+            pos = 0;
+        }
+    }
+    return parsed;
+}
+
+static Parsed parse(const std::string& input, size_t chunk = 0, size_t max_header_bytes = 1024,
+                    size_t max_body_bytes = 1024) {
+    Parser parser(max_header_bytes, max_body_bytes);
+    return parse(parser, input, chunk);
+}
+
+// Same outcome whether the input arrives at once or byte by byte
+static Parsed parse_any_split(const std::string& input) {
+    Parsed whole = parse(input);
+    for (size_t chunk : {1, 2, 5}) {
+        Parsed split = parse(input, chunk);
+        CHECK_EQ(split.error, whole.error);
+        CHECK_EQ(split.requests.size(), whole.requests.size());
+        for (size_t i = 0; i < split.requests.size(); ++i) {
+            CHECK_EQ(split.requests[i]->target, whole.requests[i]->target);
+            CHECK_EQ(split.requests[i]->body, whole.requests[i]->body);
+        }
+    }
+    return whole;
+}
+
+static void test_request_head() {
+    auto parsed = parse_any_split("GET /kv/a%20b?x=1&y=two HTTP/1.1\r\nHost: h\r\nX-Pad:  v  \r\n\r\n");
+    CHECK_EQ(parsed.error, 0);
+    CHECK_EQ(parsed.requests.size(), 1u);
+    const auto& req = *parsed.requests[0];
+    CHECK_EQ(req.method, "GET");
+    CHECK_EQ(req.path, "/kv/a b");
+    CHECK_EQ(req.get_param_value("y"), "two");
+    CHECK_EQ(req.get_header_value("X-Pad"), "v");
+    CHECK(req.body.empty());
+
+    Parser parser(1024, 1024);
+    parse(parser, "GET / HTTP/1.1\r\nConnection: close\r\n\r\n");
+    CHECK(!parser.keep_alive());
+    parse(parser, "GET / HTTP/1.0\r\n\r\n");
+    CHECK(!parser.keep_alive());
+    parse(parser, "GET / HTTP/1.0\r\nConnection: keep-alive\r\n\r\n");
+    CHECK(parser.keep_alive());
+
+    CHECK_EQ(parse("GET / HTTP/2.0\r\n\r\n").error, 505);
+    CHECK_EQ(parse("GET /\r\n\r\n").error, 400);
+    CHECK_EQ(parse("GET / HTTP/1.1\r\nBad Header: x\r\n\r\n").error, 400);
+}
+
+static void test_content_length_body() {
+    auto parsed = parse_any_split("POST /kv HTTP/1.1\r\nContent-Length: 11\r\n\r\nhello world");
+    CHECK_EQ(parsed.requests.size(), 1u);
+    CHECK_EQ(parsed.requests[0]->body, "hello world");
+
+    CHECK_EQ(parse("POST / HTTP/1.1\r\nContent-Length: 1x\r\n\r\n").error, 400);
+    CHECK_EQ(parse("POST / HTTP/1.1\r\nContent-Length: 1\r\nContent-Length: 1\r\n\r\nx").error, 400);
+}
+
+static void test_chunked_body() {
+    // Extensions and trailers are ignored; sizes are hex in either case
+    auto parsed = parse_any_split(
+        "POST /kv HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+        "5;name=value\r\nhello\r\n"
+        "1\r\n \r\n"
+        "A\r\n0123456789\r\n"
+        "0\r\nTrailer: x\r\n\r\n");
+    CHECK_EQ(parsed.error, 0);
+    CHECK_EQ(parsed.requests.size(), 1u);
+    CHECK_EQ(parsed.requests[0]->body, "hello 0123456789");
+
+    const std::string head = "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n";
+    CHECK_EQ(parse(head + "zz\r\n").error, 400);
+    CHECK_EQ(parse(head + "3\r\nabcX\r\n").error, 400); // Data longer than its size
+    CHECK_EQ(parse(head + "ffffffffffffffffff\r\n").error, 400);
+    CHECK_EQ(parse("POST / HTTP/1.1\r\nTransfer-Encoding: gzip\r\n\r\n").error, 501);
+    // Both framings at once could smuggle a request past a proxy
+    CHECK_EQ(parse("POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\nContent-Length: 3\r\n\r\n").error, 400);
+}
+
+static void test_pipelining() {
+    auto parsed = parse_any_split(
+        "POST /a HTTP/1.1\r\nContent-Length: 3\r\n\r\nabc"
+        "GET /b HTTP/1.1\r\n\r\n"
+        "PUT /c HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n2\r\nxy\r\n0\r\n\r\n"
+        "DELETE /d HTTP/1.1\r\n\r\n");
+    CHECK_EQ(parsed.requests.size(), 4u);
+    CHECK_EQ(parsed.requests[0]->body, "abc");
+    CHECK_EQ(parsed.requests[1]->path, "/b");
+    CHECK(parsed.requests[1]->body.empty());
+    CHECK_EQ(parsed.requests[2]->body, "xy");
+    CHECK_EQ(parsed.requests[3]->method, "DELETE");
+
+    // A partial head is still found after the bytes before it are dropped
+    Parser parser(1024, 1024);
+    std::string in = "POST /a HTTP/1.1\r\nContent-Length: 60\r\n\r\n" + std::string(60, 'x') + "GET /b HT";
+    size_t pos = 0;
+    CHECK(parser.parse(in, pos) == Result::Complete);
+    parser.take();
+    CHECK(parser.parse(in, pos) == Result::NeedMore);
+    in.erase(0, pos);
+    pos = 0;
+    in += "TP/1.1\r\n\r\nGET /" + std::string(200, 'c') + " HTTP/1.1\r\n\r\n";
+    CHECK(parser.parse(in, pos) == Result::Complete);
+    CHECK_EQ(parser.take()->path, "/b");
+
+    // A request that follows an error is never parsed
+    parsed = parse("GET / HTTP/9\r\n\r\nGET /next HTTP/1.1\r\n\r\n");
+    CHECK_EQ(parsed.error, 505);
+    CHECK(parsed.requests.empty());
+}
+
+static void test_limits() {
+    std::string big_header = "GET / HTTP/1.1\r\nX: " + std::string(2000, 'a') + "\r\n\r\n";
+    CHECK_EQ(parse(big_header).error, 431);
+    // Caught before the blank line arrives, too
+    CHECK_EQ(parse(big_header.substr(0, 1500), 100).error, 431);
+    CHECK_EQ(parse("GET / HTTP/1.1\r\nX: " + std::string(900, 'a') + "\r\n\r\n").error, 0);
+
+    CHECK_EQ(parse("POST / HTTP/1.1\r\nContent-Length: 1025\r\n\r\n").error, 413);
+    CHECK_EQ(parse("POST / HTTP/1.1\r\nContent-Length: 1024\r\n\r\n" + std::string(1024, 'x')).error, 0);
+    // Chunked bodies count across chunks
+    std::string chunk = "200\r\n" + std::string(512, 'x') + "\r\n";
+    CHECK_EQ(parse("POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n" + chunk + chunk + "0\r\n\r\n").error, 0);
+    CHECK_EQ(parse("POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n" + chunk + chunk + "1\r\n").error, 413);
+}
+
+static void test_expect_continue() {
+    Parser parser(1024, 1024);
+    std::string in = "POST / HTTP/1.1\r\nExpect: 100-continue\r\nContent-Length: 2\r\n\r\n";
+    size_t pos = 0;
+    CHECK(parser.parse(in, pos) == Result::NeedMore);
+    CHECK(parser.take_expect_continue());
+    CHECK(!parser.take_expect_continue()); // Once per request
+    in += "ok";
+    CHECK(parser.parse(in, pos) == Result::Complete);
+    CHECK_EQ(parser.take()->body, "ok");
+}
+
+// Routes the stream_body predicate picks get Head, then their body outside
+// the request and without the body limit
+static void test_streamed_body() {
+    size_t asked = 0;
+    Parser parser(1024, 16, [&](const httplib::Request& req) {
+        ++asked;
+        return req.path == "/import";
+    });
+    std::string body(5000, 'x');
+    for (size_t i = 0; i < body.size(); i += 7) body[i] = static_cast<char>('a' + i % 26);
+    std::string chunked;
+    for (size_t i = 0; i < body.size(); i += 1000) chunked += "3e8\r\n" + body.substr(i, 1000) + "\r\n";
+
+    for (size_t split : {0, 1, 333}) {
+        asked = 0;
+        auto parsed = parse(parser,
+                            "POST /import HTTP/1.1\r\nContent-Length: 5000\r\n\r\n" + body +
+                                "POST /import HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n" + chunked + "0\r\n\r\n"
+                                "GET /import HTTP/1.1\r\n\r\n"
+                                "POST /kv HTTP/1.1\r\nContent-Length: 2\r\n\r\nhi",
+                            split);
+        CHECK_EQ(parsed.error, 0);
+        CHECK_EQ(parsed.heads, 2u);
+        CHECK_EQ(parsed.requests.size(), 4u);
+        CHECK(parsed.requests[0]->body.empty());
+        CHECK(parsed.requests[1]->body.empty());
+        CHECK_EQ(parsed.streamed, body + body);
+        CHECK_EQ(parsed.requests[3]->body, "hi"); // Buffered as usual
+        CHECK_EQ(asked, 3u); // Only requests with a body
+    }
+
+    // Other routes keep the limit
+    CHECK_EQ(parse(parser, "POST /kv HTTP/1.1\r\nContent-Length: 17\r\n\r\n").error, 413);
+}
+
+int main() {
+    test_request_head();
+    test_content_length_body();
+    test_chunked_body();
+    test_pipelining();
+    test_limits();
+    test_expect_continue();
+    test_streamed_body();
+    return 0;
+}
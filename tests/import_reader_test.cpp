@@ -0,0 +1,102 @@
+// Unit tests for ImportReader: CSV and NDJSON edge cases and chunk splits
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include "import_reader.h"
+#include "check.h"
+
+using Rows = std::vector<std::pair<std::string, std::string>>;
+using Format = ImportReader::Format;
+
+// Feeds input in chunks of chunk bytes (0: all at once) and returns the rows
+static Rows parse(Format format, const std::string& input, size_t chunk = 0, bool skip_header = false) {
+    Rows rows;
+    ImportReader reader(format, [&](std::string key, std::string value) {
+        rows.emplace_back(std::move(key), std::move(value));
+    }, skip_header);
+    if (chunk == 0) chunk = std::max<size_t>(1, input.size());
+    for (size_t i = 0; i < input.size(); i += chunk) {
+        reader.feed(input.data() + i, std::min(chunk, input.size() - i));
+    }
+    reader.finish();
+    CHECK_EQ(reader.rows(), rows.size());
+    return rows;
+}
+
+// Same rows whatever the chunking, including one byte at a time
+static Rows parse_any_split(Format format, const std::string& input, bool skip_header = false) {
+    Rows rows = parse(format, input, 0, skip_header);
+    for (size_t chunk : {1, 2, 3, 7}) CHECK(parse(format, input, chunk, skip_header) == rows);
+    return rows;
+}
+
+// The error message parsing input throws, or "" if it succeeds
+static std::string error_of(Format format, const std::string& input) {
+    try {
+        parse(format, input, 1);
+    } catch (const std::invalid_argument& e) {
+        return e.what();
+    }
+    return "";
+}
+
+static void test_csv() {
+    // Plain, quoted, escaped quotes, embedded separators and newlines
+    CHECK((parse_any_split(Format::CSV, "a,1\n\"b,c\",\"say \"\"hi\"\"\"\n\"d\",\"two\nlines\"\n") ==
+           Rows{{"a", "1"}, {"b,c", "say \"hi\""}, {"d", "two\nlines"}}));
+
+    // CRLF endings, blank lines, no final newline, empty fields
+    CHECK((parse_any_split(Format::CSV, "a,1\r\n\r\n\nb,\r\n\"\",\"\"\r\nc,3") ==
+           Rows{{"a", "1"}, {"b", ""}, {"", ""}, {"c", "3"}}));
+
+    // A CRLF inside quotes is part of the value
+    CHECK((parse_any_split(Format::CSV, "k,\"x\r\ny\"\r\n") == Rows{{"k", "x\r\ny"}}));
+
+    // Header skipping drops only the first record, even if it is quoted
+    CHECK((parse_any_split(Format::CSV, "\"key\",\"value\"\nk,v\n", true) == Rows{{"k", "v"}}));
+    CHECK((parse_any_split(Format::CSV, "k,v\n") == Rows{{"k", "v"}}));
+    CHECK(parse(Format::CSV, "", 0, true).empty());
+
+    // A quote inside an unquoted field is kept as is
+    CHECK((parse_any_split(Format::CSV, "a\"b,c\n") == Rows{{"a\"b", "c"}}));
+}
+
+static void test_csv_errors() {
+    CHECK_EQ(error_of(Format::CSV, "a,1\nb\n"), "line 2: expected 2 fields, got 1");
+    CHECK_EQ(error_of(Format::CSV, "a,1,2\n"), "line 1: expected 2 fields, got 3");
+    CHECK_EQ(error_of(Format::CSV, "a,\"open\n"), "line 1: unterminated quoted field");
+    CHECK_EQ(error_of(Format::CSV, "\"a\"x,1\n"), "line 1: unexpected character after closing quote");
+    // Errors name the line the record started on, after multi-line values
+    CHECK_EQ(error_of(Format::CSV, "a,\"1\n2\n3\"\nb\n"), "line 4: expected 2 fields, got 1");
+}
+
+static void test_ndjson() {
+    std::string input =
+        "{\"key\":\"a\",\"value\":\"1\"}\n"
+        "\n"
+        "   \r\n"
+        "{\"value\":\"line\\nbreak\",\"key\":\"b\"}\r\n"
+        "{\"key\":\"\\u00e9\",\"value\":\"\",\"extra\":1}";
+    CHECK((parse_any_split(Format::NDJSON, input) == Rows{{"a", "1"}, {"b", "line\nbreak"}, {"\xc3\xa9", ""}}));
+    CHECK(parse_any_split(Format::NDJSON, "").empty());
+    CHECK(parse_any_split(Format::NDJSON, "\n\n").empty());
+}
+
+static void test_ndjson_errors() {
+    CHECK_EQ(error_of(Format::NDJSON, "{\"key\":\"a\",\"value\":\"1\"}\n\n[1]\n"), "line 3: not a JSON object");
+    CHECK_EQ(error_of(Format::NDJSON, "{\"key\":\"a\"\n"), "line 1: not a JSON object");
+    CHECK_EQ(error_of(Format::NDJSON, "{\"key\":\"a\"}"), "line 1: expected string \"key\" and \"value\"");
+    CHECK_EQ(error_of(Format::NDJSON, "{\"key\":\"a\",\"value\":1}"), "line 1: expected string \"key\" and \"value\"");
+    // Each object must sit on one line
+    CHECK_EQ(error_of(Format::NDJSON, "{\"key\":\"a\",\n\"value\":\"1\"}\n"), "line 1: not a JSON object");
+}
+
+int main() {
+    test_csv();
+    test_csv_errors();
+    test_ndjson();
+    test_ndjson_errors();
+    return 0;
+}
@@ -0,0 +1,197 @@
+// Unit tests for ShardedBackend: ring placement, fan-out, rejections and merged scans
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include "mock_backend.h"
+#include "sharded_backend.h"
+#include "check.h"
+
+// A mock whose batches can be made to fail or be rejected
+class FlakyBackend : public MockBackend {
+public:
+    FlakyBackend() : MockBackend(Options{}) {}
+
+    std::vector<bool> batch(const std::vector<WriteOp>& ops, bool durable) override {
+        if (fail) throw std::runtime_error("shard down");
+        if (reject) throw RejectedWrite("bad data");
+        return MockBackend::batch(ops, durable);
+    }
+
+    bool fail = false;
+    bool reject = false;
+};
+
+static std::unique_ptr<ShardedBackend> make_sharded(const std::vector<std::string>& names,
+                                                    std::vector<FlakyBackend*>* backends = nullptr) {
+    std::vector<ShardedBackend::Shard> shards;
+    for (const auto& name : names) {
+        auto backend = std::make_unique<FlakyBackend>();
+        if (backends) backends->push_back(backend.get());
+        shards.push_back({name, std::move(backend)});
+    }
+    auto sharded = std::make_unique<ShardedBackend>(std::move(shards));
+    sharded->open();
+    return sharded;
+}
+
+static std::string key(int i) {
+    return "user:" + std::to_string(i);
+}
+
+// Adding a shard moves about 1/N of the keys, all of them onto the new shard
+static void test_ring_stability() {
+    const int keys = 20000;
+    auto before = make_sharded({"a", "b", "c"});
+    auto after = make_sharded({"a", "b", "c", "d"});
+    auto reordered = make_sharded({"c", "a", "b"});
+
+    std::vector<int> per_shard(3);
+    int moved = 0;
+    for (int i = 0; i < keys; ++i) {
+        size_t old_shard = before->shard_for(key(i));
+        size_t new_shard = after->shard_for(key(i));
+        ++per_shard[old_shard];
+        if (new_shard != old_shard) {
+            CHECK_EQ(new_shard, 3u); // Only ever to "d"
+            ++moved;
+        }
+        // Placement follows names, not their order
+        static const size_t reordered_index[] = {1, 2, 0};
+        CHECK_EQ(reordered->shard_for(key(i)), reordered_index[old_shard]);
+    }
+    CHECK(moved > keys / 4 - keys / 10 && moved < keys / 4 + keys / 10);
+    for (int count : per_shard) CHECK(count > keys / 3 - keys / 10 && count < keys / 3 + keys / 10);
+}
+
+// Multi-key calls reach every shard and come back in the caller's order
+static void test_fan_out() {
+    std::vector<FlakyBackend*> backends;
+    auto sharded = make_sharded({"a", "b", "c", "d"}, &backends);
+
+    std::vector<WriteOp> ops;
+    std::vector<std::string> keys;
+    for (int i = 0; i < 100; ++i) {
+        ops.push_back(WriteOp{WriteOp::Kind::Put, key(i), std::to_string(i)});
+        keys.push_back(key(i));
+    }
+    sharded->batch(ops, true);
+    keys.push_back("missing");
+    auto values = sharded->multi_get(keys);
+    CHECK_EQ(values.size(), keys.size());
+    for (int i = 0; i < 100; ++i) CHECK(values[i] == std::to_string(i));
+    CHECK(!values.back().has_value());
+
+    // Deletes report per key whether it existed
+    auto existed = sharded->batch({WriteOp{WriteOp::Kind::Delete, key(1), ""},
+                                   WriteOp{WriteOp::Kind::Delete, "missing", ""}}, true);
+    CHECK(existed == (std::vector<bool>{true, false}));
+
+    // One failing shard fails the call once the others are done
+    backends[2]->fail = true;
+    bool threw = false;
+    try {
+        sharded->batch(ops, true);
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    CHECK(threw);
+    backends[2]->fail = false;
+    sharded->batch(ops, true);
+}
+
+// A rejection on one shard reports what the others applied
+static void test_partial_rejection() {
+    std::vector<FlakyBackend*> backends;
+    auto sharded = make_sharded({"a", "b", "c"}, &backends);
+    std::vector<WriteOp> ops;
+    for (int i = 0; i < 30; ++i) ops.push_back(WriteOp{WriteOp::Kind::Put, key(i), "v"});
+    ops.push_back(WriteOp{WriteOp::Kind::Delete, key(0), ""});
+    sharded->batch({WriteOp{WriteOp::Kind::Put, key(0), "old"}}, true);
+
+    size_t bad = sharded->shard_for(key(1));
+    backends[bad]->reject = true;
+    std::vector<std::optional<bool>> applied;
+    try {
+        sharded->batch(ops, true);
+    } catch (const RejectedWrite& e) {
+        applied = e.applied();
+    }
+    CHECK_EQ(applied.size(), ops.size());
+    for (size_t i = 0; i < ops.size(); ++i) {
+        bool on_bad = sharded->shard_for(ops[i].key) == bad;
+        CHECK_EQ(applied[i].has_value(), !on_bad);
+        // key(0) is put then deleted: only the rejecting shard still has it
+        CHECK_EQ(sharded->get(ops[i].key).has_value(), ops[i].key == key(0) ? on_bad : !on_bad);
+    }
+    if (sharded->shard_for(key(0)) != bad) CHECK(applied.back() == std::optional<bool>(true));
+
+    // Nothing applied: nothing to report
+    bool plain = false;
+    try {
+        sharded->batch({WriteOp{WriteOp::Kind::Put, key(1), "v"}}, true);
+    } catch (const RejectedWrite& e) {
+        plain = e.applied().empty();
+    }
+    CHECK(plain);
+}
+
+// Scans and cursors merge the shards in byte order, high bytes last
+static void test_merge_order() {
+    auto sharded = make_sharded({"a", "b", "c"});
+    std::vector<std::string> keys = {"p/B", "p/a", "p/\xc3\xa9", "p/", "p/aa", "p/Z", "p/\x7f", "q", "o"};
+    std::vector<WriteOp> ops;
+    for (const auto& k : keys) ops.push_back(WriteOp{WriteOp::Kind::Put, k, "v"});
+    sharded->batch(ops, true);
+    const std::vector<std::string> expected = {"p/", "p/B", "p/Z", "p/a", "p/aa", "p/\x7f", "p/\xc3\xa9"};
+
+    std::vector<std::string> scanned;
+    std::optional<std::string> after;
+    while (true) {
+        auto page = sharded->scan("p/", after, 2);
+        for (const auto& entry : page) scanned.push_back(entry.first);
+        if (page.size() < 2) break;
+        after = page.back().first;
+    }
+    CHECK(scanned == expected);
+
+    auto cursor = sharded->open_cursor("p/");
+    std::vector<std::string> walked;
+    for (auto batch = cursor->next(3); !batch.empty(); batch = cursor->next(3)) {
+        for (const auto& entry : batch) walked.push_back(entry.first);
+    }
+    CHECK(walked == expected);
+}
+
+// The empty key is a key like any other: first in every full scan
+static void test_empty_key() {
+    auto sharded = make_sharded({"a", "b", "c"});
+    sharded->batch({WriteOp{WriteOp::Kind::Put, "", "empty"}, WriteOp{WriteOp::Kind::Put, "\x01", "v"},
+                    WriteOp{WriteOp::Kind::Put, "a", "v"}}, true);
+
+    auto page = sharded->scan("", std::nullopt, 2);
+    CHECK_EQ(page.size(), 2u);
+    CHECK_EQ(page[0].first, "");
+    CHECK_EQ(page[0].second, "empty");
+    CHECK_EQ(page[1].first, "\x01");
+    page = sharded->scan("", std::string(), 10); // Resuming after it
+    CHECK_EQ(page.size(), 2u);
+    CHECK_EQ(page[0].first, "\x01");
+
+    auto cursor = sharded->open_cursor("");
+    auto batch = cursor->next(1);
+    CHECK_EQ(batch.size(), 1u);
+    CHECK_EQ(batch[0].first, "");
+    CHECK_EQ(cursor->next(10).size(), 2u);
+}
+
+int main() {
+    test_ring_stability();
+    test_fan_out();
+    test_partial_rejection();
+    test_merge_order();
+    test_empty_key();
+    return 0;
+}
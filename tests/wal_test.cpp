@@ -0,0 +1,152 @@
+// Unit tests for WriteAheadLog: replay, checkpoints and torn tails
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+#include "write_ahead_log.h"
+#include "check.h"
+
+static std::string make_dir() {
+    char path[] = "/tmp/wal_test_XXXXXX";
+    CHECK(mkdtemp(path) != nullptr);
+    return path;
+}
+
+static void remove_dir(const std::string& dir) {
+    std::string command = "rm -rf '" + dir + "'";
+    CHECK(std::system(command.c_str()) == 0);
+}
+
+// Records written before a restart come back in LSN order
+static void test_replay() {
+    std::string dir = make_dir();
+    {
+        WriteAheadLog wal(dir, 1 << 20);
+        CHECK(wal.recover().empty());
+        CHECK_EQ(wal.append(WalRecord::Op::Put, "a", "1"), 1u);
+        CHECK_EQ(wal.append(WalRecord::Op::Put, "b", "2"), 2u);
+        CHECK_EQ(wal.append(WalRecord::Op::Delete, "a", ""), 3u);
+    }
+    WriteAheadLog wal(dir, 1 << 20);
+    auto records = wal.recover();
+    CHECK_EQ(records.size(), 3u);
+    CHECK_EQ(records[0].lsn, 1u);
+    CHECK(records[0].op == WalRecord::Op::Put && records[0].key == "a" && records[0].value == "1");
+    CHECK(records[1].key == "b" && records[1].value == "2");
+    CHECK(records[2].op == WalRecord::Op::Delete && records[2].key == "a");
+    // New records continue the sequence
+    CHECK_EQ(wal.append(WalRecord::Op::Put, "c", "3"), 4u);
+    remove_dir(dir);
+}
+
+// A missing directory (and its parents) is created on recovery only
+static void test_create_directory() {
+    std::string dir = make_dir();
+    std::string nested = dir + "/a/b/wal";
+    WriteAheadLog wal(nested, 1 << 20);
+    CHECK(!wal.has_segments());
+    CHECK(wal.recover().empty());
+    CHECK(wal.has_segments());
+    wal.append(WalRecord::Op::Put, "a", "1");
+    remove_dir(dir);
+}
+
+// Records at or below the checkpoint are not replayed, even from the active
+// segment, and LSNs keep growing past it
+static void test_checkpoint_skips_applied() {
+    std::string dir = make_dir();
+    {
+        WriteAheadLog wal(dir, 1 << 20);
+        wal.recover();
+        for (int i = 0; i < 5; ++i) wal.append(WalRecord::Op::Put, "k" + std::to_string(i), "v");
+        wal.checkpoint(3);
+    }
+    {
+        WriteAheadLog wal(dir, 1 << 20);
+        auto records = wal.recover();
+        CHECK_EQ(records.size(), 2u);
+        CHECK_EQ(records[0].lsn, 4u);
+        CHECK_EQ(records[1].lsn, 5u);
+        wal.checkpoint(5);
+    }
+    WriteAheadLog wal(dir, 1 << 20);
+    CHECK(wal.recover().empty());
+    CHECK_EQ(wal.append(WalRecord::Op::Put, "k", "v"), 6u);
+    remove_dir(dir);
+}
+
+// Checkpoints delete fully applied segments but never the active one
+static void test_checkpoint_removes_segments() {
+    std::string dir = make_dir();
+    WriteAheadLog wal(dir, 64); // A few records per segment
+    wal.recover();
+    for (int i = 0; i < 20; ++i) wal.append(WalRecord::Op::Put, "key" + std::to_string(i), std::string(20, 'x'));
+    auto segments = [&] {
+        size_t count = 0;
+        DIR* d = opendir(dir.c_str());
+        CHECK(d != nullptr);
+        while (dirent* entry = readdir(d)) count += std::string(entry->d_name).rfind("wal-", 0) == 0;
+        closedir(d);
+        return count;
+    };
+    size_t before = segments();
+    CHECK(before > 2);
+    wal.checkpoint(20);
+    CHECK_EQ(segments(), 1u);
+    remove_dir(dir);
+}
+
+// A torn record at the tail is dropped and the intact ones survive
+static void test_torn_tail() {
+    std::string dir = make_dir();
+    {
+        WriteAheadLog wal(dir, 1 << 20);
+        wal.recover();
+        wal.append(WalRecord::Op::Put, "a", "1");
+        wal.append(WalRecord::Op::Put, "b", "2");
+    }
+    std::string segment = dir + "/wal-00000000000000000001.log";
+    struct stat st {};
+    CHECK(stat(segment.c_str(), &st) == 0);
+    CHECK(truncate(segment.c_str(), st.st_size - 3) == 0);
+
+    WriteAheadLog wal(dir, 1 << 20);
+    auto records = wal.recover();
+    CHECK_EQ(records.size(), 1u);
+    CHECK_EQ(records[0].key, "a");
+    CHECK_EQ(wal.append(WalRecord::Op::Put, "c", "3"), 2u);
+    remove_dir(dir);
+}
+
+// Concurrent appenders hand their records on once durable, in LSN order
+static void test_on_logged_order() {
+    std::string dir = make_dir();
+    WriteAheadLog wal(dir, 4096);
+    wal.recover();
+    std::vector<uint64_t> logged;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 8; ++t) {
+        threads.emplace_back([&] {
+            for (int i = 0; i < 50; ++i) {
+                wal.append(WalRecord::Op::Put, "key", "value", [&](uint64_t lsn) { logged.push_back(lsn); });
+            }
+        });
+    }
+    for (auto& thread : threads) thread.join();
+    CHECK_EQ(logged.size(), 400u);
+    for (size_t i = 0; i < logged.size(); ++i) CHECK_EQ(logged[i], i + 1);
+    remove_dir(dir);
+}
+
+int main() {
+    test_replay();
+    test_create_directory();
+    test_checkpoint_skips_applied();
+    test_checkpoint_removes_segments();
+    test_torn_tail();
+    test_on_logged_order();
+    return 0;
+}
@@ -0,0 +1,131 @@
+// Unit tests for WriteBehindQueue: draining, overlay and rejected records
+#include <sys/stat.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include "write_behind.h"
+#include "check.h"
+
+using ApplyResult = WriteBehindQueue::ApplyResult;
+using WaitResult = WriteBehindQueue::WaitResult;
+
+static std::string make_dir() {
+    char path[] = "/tmp/write_behind_test_XXXXXX";
+    CHECK(mkdtemp(path) != nullptr);
+    return path;
+}
+
+static void remove_dir(const std::string& dir) {
+    std::string command = "rm -rf '" + dir + "'";
+    CHECK(std::system(command.c_str()) == 0);
+}
+
+// Runs test in a fresh WAL directory, removed once the queue has stopped
+static void run(void (*test)(const std::string&)) {
+    std::string dir = make_dir();
+    test(dir);
+    remove_dir(dir);
+}
+
+static bool wait_for(const std::function<bool()>& condition) {
+    for (int i = 0; i < 500; ++i) {
+        if (condition()) return true;
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return false;
+}
+
+// Pending writes show in the overlay until applied, then drain away
+static void test_drain(const std::string& dir) {
+    WriteAheadLog wal(dir, 1 << 20);
+    std::mutex mutex;
+    std::vector<std::string> applied;
+    WriteBehindQueue queue(wal, [&](const std::vector<WalRecord>& records) {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const auto& record : records) applied.push_back(record.key);
+        return ApplyResult::Applied;
+    }, 10, 1000, std::chrono::milliseconds(10));
+    queue.start(wal.recover());
+
+    auto lsn = queue.put("a", "1");
+    CHECK(lsn.has_value());
+    CHECK(queue.remove("b").has_value());
+    CHECK(queue.wait_applied(*lsn + 1, std::chrono::milliseconds(5000)) == WaitResult::Applied);
+    CHECK(!queue.pending("a").has_value());
+    CHECK_EQ(queue.backlog(), 0u);
+    std::lock_guard<std::mutex> lock(mutex);
+    CHECK_EQ(applied.size(), 2u);
+    CHECK_EQ(applied[0], "a");
+    CHECK_EQ(applied[1], "b");
+}
+
+// A rejected batch is applied record by record; the bad record is dead-lettered,
+// its waiter is told so, and the ones around it still reach the store
+static void test_rejected_record(const std::string& dir) {
+    WriteAheadLog wal(dir, 1 << 20);
+    std::mutex mutex;
+    std::set<std::string> stored;
+    bool hold = true; // Keep the first batch back until every record is queued
+    WriteBehindQueue queue(wal, [&](const std::vector<WalRecord>& records) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (hold) return ApplyResult::Failed;
+        for (const auto& record : records) {
+            if (record.key == "bad") return ApplyResult::Rejected;
+        }
+        for (const auto& record : records) stored.insert(record.key);
+        return ApplyResult::Applied;
+    }, 10, 1000, std::chrono::milliseconds(10));
+    queue.start(wal.recover());
+
+    std::map<std::string, uint64_t> lsns;
+    for (const char* key : {"a", "b", "bad", "c", "d"}) lsns[key] = *queue.put(key, "value");
+    // Waiting from before the record is drained
+    WaitResult bad_result = WaitResult::Applied;
+    std::thread waiter([&] { bad_result = queue.wait_applied(lsns["bad"], std::chrono::milliseconds(5000)); });
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        hold = false;
+    }
+    waiter.join();
+    CHECK(bad_result == WaitResult::Rejected);
+    CHECK(queue.wait_applied(lsns["d"], std::chrono::milliseconds(5000)) == WaitResult::Applied);
+    CHECK(queue.wait_applied(lsns["a"], std::chrono::milliseconds(0)) == WaitResult::Applied);
+    // And after it
+    CHECK(queue.wait_applied(lsns["bad"], std::chrono::milliseconds(0)) == WaitResult::Rejected);
+    CHECK(!queue.pending("bad").has_value());
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        CHECK((stored == std::set<std::string>{"a", "b", "c", "d"}));
+    }
+    struct stat st {};
+    CHECK(stat((dir + "/dead-letter.log").c_str(), &st) == 0 && st.st_size > 0);
+
+    // Back to full batches afterwards
+    CHECK(wait_for([&] { return queue.backlog() == 0; }));
+}
+
+// Transient failures are retried until the store takes the batch
+static void test_retry(const std::string& dir) {
+    WriteAheadLog wal(dir, 1 << 20);
+    int attempts = 0;
+    WriteBehindQueue queue(wal, [&](const std::vector<WalRecord>&) {
+        return ++attempts < 3 ? ApplyResult::Failed : ApplyResult::Applied;
+    }, 10, 1000, std::chrono::milliseconds(10));
+    queue.start(wal.recover());
+    auto lsn = queue.put("a", "1");
+    CHECK(queue.wait_applied(*lsn, std::chrono::milliseconds(5000)) == WaitResult::Applied);
+    CHECK_EQ(attempts, 3);
+}
+
+int main() {
+    run(test_drain);
+    run(test_rejected_record);
+    run(test_retry);
+    return 0;
+}